@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <stdbool.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -12,19 +13,52 @@
 #include <time.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/vfs.h>
 #include <sys/ioctl.h>
-#include <sys/select.h>
-#include <sys/time.h>
+#include <sys/timerfd.h>
+#include <poll.h>
 #include <errno.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <setjmp.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
 
 /* Game constants */
-#define MAX_SNAKE_LEN 1000
 #define BOARD_WIDTH 78
 #define BOARD_HEIGHT 18
+#define BOARD_CELLS (BOARD_WIDTH * BOARD_HEIGHT)
+#define MAX_SNAKE_LEN BOARD_CELLS    /* the game is won when the snake fills the board */
+#define OLD_MAX_SNAKE_LEN 1000       /* length cap of layout versions 1 to 4 */
+#define OCCUPANCY_WORDS ((BOARD_CELLS + 31) / 32)
 #define MEM_FILE "/dev/mem"
+#define MEM_OFFSET 0x200000000      /* fabric window offset in /dev/mem */
+#define HUGETLBFS_MAGIC 0x958458f6  /* statfs f_type of a hugetlbfs mount */
 #define INITIAL_SNAKE_LEN 3
 #define BASE_MOVE_INTERVAL_MS 200
 #define MIN_MOVE_INTERVAL_MS 50
+#define HEARTBEAT_INTERVAL_MS 500   /* default, see --heartbeat-ms */
+#define LEASE_TICKS 2   /* heartbeat intervals a lease survives without renewal */
+#define TAKEOVER_DELAY_MS 200       /* default, see --takeover-delay-ms */
+#define HANDOFF_TIMEOUT_MS 3000     /* 't' handoff aborts without an accept by then */
+#define MIN_TIMING_MS 10            /* lower bound of configurable intervals */
+#define DETECTOR_DEV_FACTOR 4       /* detector timeout = mean + factor * deviation */
+#define CLOCK_SLACK_MS 1000         /* tolerated realtime clock skew between nodes */
+#define MAX_STANDBYS 8              /* registered waiting processes per game */
+#define STANDBY_STALE_CHECKS 3      /* missed checks before a standby entry is stale */
+#define MAX_PRIORITY 1000
+#define FRAME_INTERVAL_MS 16          /* ~60 FPS cap while active */
+#define SPECTATOR_FPS 10              /* default, see --spectator-fps */
+#define MAX_SPECTATOR_FPS 60
+#define WAKE_WAIT_MS 1000               /* bound on one futex wait of the wake thread */
 
 /* Direction constants */
 #define DIR_UP    0
@@ -32,10 +66,30 @@
 #define DIR_LEFT  2
 #define DIR_RIGHT 3
 
+/* Decoded keys beyond the byte range (arrow key escape sequences) */
+#define KEY_UP    0x100
+#define KEY_DOWN  0x101
+#define KEY_LEFT  0x102
+#define KEY_RIGHT 0x103
+
+/* Input escape sequence decoder states */
+#define ESC_NONE  0
+#define ESC_START 1   /* got ESC */
+#define ESC_CSI   2   /* got ESC [ */
+
+/* poll() slots for the main loop */
+#define POLL_STDIN     0
+#define POLL_MOVE      1   /* move tick (active) or handoff commit poll (waiting) */
+#define POLL_HEARTBEAT 2   /* heartbeat tick (active) or liveness check (waiting) */
+#define POLL_RENDER    3
+#define POLL_WAKE      4   /* futex wakeup bridged by the wake thread (waiting, handoff) */
+#define POLL_COUNT     5
+
 /* Game state constants */
 #define STATE_RUNNING  0
 #define STATE_PAUSED   1
 #define STATE_GAMEOVER 2
+#define STATE_WON      3   /* the snake covers every cell */
 
 /* ANSI color codes */
 #define COLOR_RESET   "\033[0m"
@@ -49,7 +103,88 @@
 #define COLOR_BG_GREEN "\033[42m"
 #define COLOR_BG_RED   "\033[41m"
 
-#define MAGIC_NUMBER    0x12345678
+/* Terminal frame dimensions */
+#define SCREEN_WIDTH  80
+#define SCREEN_HEIGHT 24
+
+/* Output buffer: worst case is a cursor move plus an SGR code per cell */
+#define OUT_BUF_SIZE  (SCREEN_WIDTH * SCREEN_HEIGHT * 16)
+
+/* Color indices used by the frame buffer */
+#define CLR_DEFAULT      0
+#define CLR_WHITE        1
+#define CLR_CYAN         2
+#define CLR_YELLOW       3
+#define CLR_GREEN        4
+#define CLR_BRIGHT_GREEN 5
+#define CLR_RED          6
+
+/* Shared region identification. The magic never changes; incompatible
+ * layout changes bump LAYOUT_VERSION and add a migration step. Optional
+ * fields added in spare space of an existing block are announced through
+ * feature_flags instead, so older builds can keep attaching. The flags
+ * describe the build that owns the game: each owner writes its own set
+ * when it takes the lease, and a newcomer reads them to learn which
+ * fields the running owner maintains. */
+#define REGION_MAGIC         0x534E4B45  /* "SNKE" */
+#define LAYOUT_VERSION       5
+#define LEGACY_MAGIC_NUMBER  0x12345678  /* unversioned layout, version 1 */
+#define FEATURE_SEQLOCK      (1u << 0)   /* seq guards the game data */
+#define FEATURE_LEASE        (1u << 1)   /* lease fences the active role */
+#define FEATURE_HEARTBEAT_MS (1u << 2)   /* owner publishes its heartbeat period */
+#define FEATURE_HEARTBEAT_TIME (1u << 3) /* heartbeat_time is maintained */
+#define FEATURE_WAKE         (1u << 4)   /* owner_node and the wake futex are maintained */
+#define FEATURE_FENCE        (1u << 5)   /* owner_stamp and fence_events are maintained */
+#define FEATURE_HANDOFF      (1u << 6)   /* two-phase handoff fields are maintained */
+#define FEATURE_RNG          (1u << 7)   /* food comes from the shared generator */
+#define FEATURES_KNOWN       (FEATURE_SEQLOCK | FEATURE_LEASE | FEATURE_HEARTBEAT_MS | \
+                              FEATURE_HEARTBEAT_TIME | FEATURE_WAKE | FEATURE_FENCE | \
+                              FEATURE_HANDOFF | FEATURE_RNG)  /* feature_flags bits this build sets up */
+
+/* Lease word: the epoch counts ownership changes, the owner is a random
+ * per-process id. Owner 0 means nobody holds the lease: the region was
+ * never owned or its last owner released it on a clean shutdown. */
+#define LEASE_EPOCH(lease) ((uint32_t)((lease) >> 32))
+#define LEASE_OWNER(lease) ((uint32_t)(lease))
+
+/* Multi-session regions: a session directory followed by one GameState
+ * slot per session, each slot starting on a 4 KB boundary */
+#define SESSION_DIR_MAGIC       0x534E4B44  /* "DKNS" */
+#define SESSION_DIR_FORMATTING  0x534E4B46  /* directory being initialized */
+#define SESSION_DIR_VERSION     1
+#define SESSION_ALIGN           4096
+#define DEFAULT_SESSIONS        64
+#define MAX_SESSIONS            4096
+
+/* Session slot states */
+#define SLOT_FREE     0
+#define SLOT_CLAIMING 1   /* being allocated, session_id not valid yet */
+#define SLOT_USED     2
+
+/* Long-only command line options */
+#define OPT_HEARTBEAT_MS      0x100
+#define OPT_CHECK_MS          0x101
+#define OPT_PROBE_MS          0x102
+#define OPT_TAKEOVER_DELAY_MS 0x103
+#define OPT_PRIORITY          0x104
+#define OPT_SPECTATOR_FPS     0x105
+#define OPT_SEED              0x106
+
+/* Session commands that run instead of the game */
+#define SESSION_CMD_NONE 0
+#define SESSION_CMD_LIST 1
+#define SESSION_CMD_FREE 2
+
+/* Snapshot attempts before a reader gives up on a writer stuck mid-update */
+#define SNAPSHOT_RETRIES 100
+
+/* Shared state is partitioned and flushed at this granularity */
+#define CACHE_LINE_SIZE 64
+
+/* The body is stored as the head and tail cells plus the direction of
+ * each step from one segment to the next, packed four to a byte */
+#define BODY_BYTES ((MAX_SNAKE_LEN + 3) / 4)
+#define OLD_BODY_BYTES ((OLD_MAX_SNAKE_LEN + 3) / 4)
 
 /* Point structure */
 typedef struct {
@@ -57,10 +192,195 @@ typedef struct {
     int32_t y;
 } Point;
 
-/* Shared game state structure */
+/* Registration of a waiting process, one per cache line since each
+ * standby rewrites its own entry on every check */
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t owner_id;  /* lease owner id, 0 = free */
+    uint32_t pid;
+    uint32_t node_id;             /* hash of the host name */
+    int32_t priority;             /* higher is preferred as handoff target */
+    uint32_t check_ms;            /* period at which last_seen is refreshed */
+    uint32_t fence_events;        /* times this process was fenced since it last owned the game */
+    _Atomic uint64_t last_seen;   /* CLOCK_REALTIME ms of the standby's last check */
+    _Atomic uint32_t handoff_accept;  /* owner_id once it accepted a handoff, 0 = none */
+} StandbySlot;
+
+/* Shared game state structure.
+ *
+ * Each region starts on its own cache line so that fields written by
+ * different roles never share a line: a waiter clearing takeover_request
+ * or polling the heartbeat does not contend with the active process
+ * updating the game, and a flush of one region cannot write back stale
+ * data of another. */
+typedef struct {
+    /* Header - written when the region is formatted or migrated, and
+     * feature_flags by each new owner */
+    _Alignas(CACHE_LINE_SIZE) uint32_t magic_number;   /* REGION_MAGIC */
+    uint32_t layout_version;
+    uint32_t struct_size;         /* sizeof(GameState) of the writer */
+    uint32_t feature_flags;
+    uint16_t board_width;
+    uint16_t board_height;
+    uint32_t max_snake_len;
+
+    /* Active control block - written only by the active process */
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t heartbeat;  /* release-published liveness tick */
+    uint32_t game_state;
+    uint32_t direction;
+    uint32_t snake_length;
+    uint32_t body_tail;           /* index in body[] of the step leaving the tail */
+    int16_t head_x;
+    int16_t head_y;
+    int16_t tail_x;
+    int16_t tail_y;
+    int32_t food_x;
+    int32_t food_y;
+    _Atomic uint32_t seq;         /* seqlock: odd while the game data is being updated */
+    uint64_t heartbeat_time;      /* CLOCK_REALTIME ms of the last heartbeat, 0 = unknown */
+    _Atomic uint64_t owner_stamp; /* lease word of the last process to write the game */
+
+    /* Ownership block - the lease is claimed by compare-and-swap. A 't'
+     * handoff runs request (active) -> accept (target, in its standby
+     * entry) -> commit (active moves the lease to the target). */
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t takeover_request;  /* owner id of the handoff target, 0 = none */
+    uint32_t lease_ticks;         /* heartbeat ticks the owner's lease lasts without renewal */
+    _Atomic uint64_t lease;       /* LEASE_EPOCH << 32 | LEASE_OWNER */
+    uint32_t heartbeat_ms;        /* owner's heartbeat period, 0 = HEARTBEAT_INTERVAL_MS */
+    uint32_t owner_node;          /* node id of the lease owner */
+    _Atomic uint32_t wake_seq;    /* futex word, bumped on events waiters watch for */
+    _Atomic uint32_t wake_until;  /* monotonic ms (low 32 bits) until which a wake thread may sleep */
+    uint32_t handoff_phase_ms;    /* time since the last move at commit */
+
+    /* Stats block - read by waiting processes for display */
+    _Alignas(CACHE_LINE_SIZE) uint32_t score;
+    uint32_t high_score;
+    uint32_t fence_events;        /* fencing events folded in by owners, see fence_total() */
+    uint64_t rng_state;           /* PCG32 state, advanced only by the active */
+    uint64_t rng_inc;             /* PCG32 stream (odd), 0 = not seeded yet */
+    uint64_t rng_seed;            /* seed of the current game, for replay */
+
+    /* Board and body */
+    _Alignas(CACHE_LINE_SIZE) uint32_t occupancy[OCCUPANCY_WORDS];  /* 1 bit per board cell covered by the snake */
+    _Alignas(CACHE_LINE_SIZE) uint8_t body[BODY_BYTES];  /* ring of 2-bit steps, tail -> head */
+
+    /* Standby registry - each entry written only by its standby */
+    StandbySlot standbys[MAX_STANDBYS];
+} GameState;
+
+/* Layout versions 3 and 4 had a body ring of OLD_MAX_SNAKE_LEN steps;
+ * version 3 ended there, version 4 appended the standby registry */
+#define LAYOUT_V4_STANDBYS \
+    ((offsetof(GameState, body) + OLD_BODY_BYTES + CACHE_LINE_SIZE - 1) / \
+     CACHE_LINE_SIZE * CACHE_LINE_SIZE)
+#define LAYOUT_V3_SIZE LAYOUT_V4_STANDBYS
+#define LAYOUT_V4_SIZE (LAYOUT_V4_STANDBYS + MAX_STANDBYS * sizeof(StandbySlot))
+
+/* Check that a block starts on a cache line and ends before the next block */
+#define STATE_BLOCK_ASSERT(first, last, next) \
+    _Static_assert(offsetof(GameState, first) % CACHE_LINE_SIZE == 0 && \
+                   offsetof(GameState, last) + sizeof(((GameState *)0)->last) <= \
+                   offsetof(GameState, next) && \
+                   offsetof(GameState, next) - offsetof(GameState, first) <= \
+                   CACHE_LINE_SIZE, #first " block must fill one cache line")
+
+/* The control fields are shared between processes, possibly on different
+ * nodes, so their atomics must not fall back to process-local locks */
+_Static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+               "shared control fields need lock-free atomics");
+
+STATE_BLOCK_ASSERT(magic_number, max_snake_len, heartbeat);
+STATE_BLOCK_ASSERT(heartbeat, owner_stamp, takeover_request);
+STATE_BLOCK_ASSERT(takeover_request, handoff_phase_ms, score);
+STATE_BLOCK_ASSERT(score, rng_seed, occupancy);
+_Static_assert(offsetof(GameState, occupancy) % CACHE_LINE_SIZE == 0,
+               "occupancy must start on a cache line");
+_Static_assert(offsetof(GameState, body) % CACHE_LINE_SIZE == 0,
+               "snake body must start on a cache line");
+_Static_assert(offsetof(GameState, standbys) % CACHE_LINE_SIZE == 0 &&
+               sizeof(StandbySlot) == CACHE_LINE_SIZE,
+               "standby entries must each fill one cache line");
+_Static_assert(BOARD_WIDTH <= INT16_MAX && BOARD_HEIGHT <= INT16_MAX,
+               "head and tail coordinates are stored as int16_t");
+
+/* One character cell of a terminal frame */
+typedef struct {
+    char ch;
+    uint8_t color;
+} Cell;
+
+/* Number of cache lines covered by the shared state */
+#define STATE_LINES ((sizeof(GameState) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE)
+
+/* Record a write to a GameState field for the next state_flush() */
+#define STATE_DIRTY(field) state_mark_dirty(&g_state->field, sizeof(g_state->field))
+
+/* Drop any stale cached copy of a GameState field before reading it */
+#define STATE_INVALIDATE(field) state_invalidate(&g_state->field, sizeof(g_state->field))
+
+/* Cache maintenance backend used to make shared state writes visible to
+ * other nodes and to discard stale copies before reading */
+typedef struct {
+    const char *name;
+    bool (*probe)(void);                          /* usable on this CPU? */
+    void (*clean)(const void *addr, size_t len);  /* write back a range */
+    void (*invalidate)(const void *addr, size_t len);  /* drop a range */
+    void (*drain)(void);                          /* wait for cleans/invalidates */
+} FlushBackend;
+
+/* Session directory entry */
+typedef struct {
+    _Atomic uint32_t state;       /* SLOT_FREE, SLOT_CLAIMING or SLOT_USED */
+    uint32_t session_id;
+    uint64_t created;             /* CLOCK_REALTIME seconds at allocation */
+} SessionSlot;
+
+/* Session directory at the start of a multi-session region */
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t magic;  /* SESSION_DIR_MAGIC */
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t slot_size;           /* bytes per GameState slot */
+    uint64_t slots_offset;        /* offset of slot 0 from the directory */
+    _Alignas(CACHE_LINE_SIZE) SessionSlot slots[];
+} SessionDirectory;
+
+
+/* Stride of GameState slots in a multi-session region. Sessions never
+ * held the layouts that migrate from a larger struct, so a slot only
+ * needs the current one. */
+#define SESSION_SLOT_SIZE \
+    ((sizeof(GameState) + SESSION_ALIGN - 1) / SESSION_ALIGN * SESSION_ALIGN)
+
+/* Failure detector of a waiting process. It tracks when the heartbeat
+ * or lease last changed and estimates the owner's heartbeat inter-arrival
+ * time and its mean deviation, both in ms scaled by 8 as in TCP's RTT
+ * estimator. */
+typedef struct {
+    uint64_t heartbeat;
+    uint64_t lease;
+    uint64_t last_change;         /* local time of the last change */
+    uint64_t mean8;
+    uint64_t dev8;
+} FailureDetector;
+
+/* Consistent copy of the game data taken by readers */
+typedef struct {
+    uint32_t game_state;
+    uint32_t score;
+    uint32_t high_score;
+    uint32_t snake_length;
+    uint32_t fence_events;
+    int32_t food_x;
+    int32_t food_y;
+    Point head;
+    uint32_t occupancy[OCCUPANCY_WORDS];
+} GameSnapshot;
+
+/* Unversioned layout used before the header existed (layout version 1),
+ * kept to migrate live regions in place */
 typedef struct {
     uint64_t heartbeat;
-    uint32_t magic_number;
+    uint32_t magic_number;        /* LEGACY_MAGIC_NUMBER */
     uint32_t game_state;
     uint32_t score;
     uint32_t high_score;
@@ -68,9 +388,61 @@ typedef struct {
     uint32_t direction;
     int32_t food_x;
     int32_t food_y;
-    uint32_t takeover_request;    /* 1 = active wants to hand over control */
-    Point snake[MAX_SNAKE_LEN];
-} GameState;
+    uint32_t takeover_request;
+    Point snake[OLD_MAX_SNAKE_LEN];   /* snake[0] is the head */
+} LegacyGameState;
+
+/* Layout version 2, with the body as a ring of Points, kept to migrate
+ * live regions in place */
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) uint32_t magic_number;
+    uint32_t layout_version;
+    uint32_t struct_size;
+    uint32_t feature_flags;
+    uint16_t board_width;
+    uint16_t board_height;
+    uint32_t max_snake_len;
+
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t heartbeat;
+    uint32_t game_state;
+    uint32_t direction;
+    uint32_t snake_length;
+    uint32_t snake_head;          /* index of the head segment in snake[] */
+    uint32_t snake_tail;          /* index of the tail segment in snake[] */
+    int32_t food_x;
+    int32_t food_y;
+    _Atomic uint32_t seq;
+
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t takeover_request;
+
+    _Alignas(CACHE_LINE_SIZE) uint32_t score;
+    uint32_t high_score;
+
+    _Alignas(CACHE_LINE_SIZE) uint32_t occupancy[OCCUPANCY_WORDS];
+    _Alignas(CACHE_LINE_SIZE) Point snake[OLD_MAX_SNAKE_LEN];   /* ring buffer, tail -> head */
+} GameStateV2;
+
+/* Bytes mapped for a GameState: enough to read any layout we migrate from */
+#define STATE_MAP_SIZE \
+    (sizeof(GameStateV2) > sizeof(GameState) ? sizeof(GameStateV2) : sizeof(GameState))
+
+_Static_assert(sizeof(LegacyGameState) <= STATE_MAP_SIZE,
+               "legacy layout must fit in the mapping");
+
+/* Memory backend providing the shared region */
+typedef struct {
+    const char *name;
+    const char *default_path;
+    off_t default_offset;
+    const char *auto_flush;   /* flush backend for "-f auto", NULL = best for the CPU */
+    int (*open)(const char *path, off_t offset, size_t *map_len);  /* fd, may grow *map_len */
+    int hugepages;            /* how --hugepages is honoured, HUGE_* */
+} MemBackend;
+
+/* Huge page support of a memory backend */
+#define HUGE_NONE    0   /* cannot provide huge pages, -H is rejected */
+#define HUGE_OPEN    1   /* the open function allocates them */
+#define HUGE_ADVISE  2   /* transparent huge pages via madvise */
 
 /* Global variables */
 static GameState *g_state = NULL;
@@ -79,9 +451,64 @@ static struct termios g_orig_termios;
 static bool g_terminal_raw = false;
 static volatile sig_atomic_t g_running = 1;
 static bool g_is_active = false;
-static bool g_initiated_takeover = false;  /* True if we pressed 't' */
-static const char *g_mem_file = MEM_FILE;  /* mmap file path */
-static off_t g_mem_offset = 0x200000000;   /* mmap offset */
+static uint32_t g_owner_id = 0;     /* lease owner id of this process */
+static uint32_t g_node_id = 0;      /* hash of the host name */
+static int32_t g_priority = 0;      /* standby priority */
+static bool g_seed_set = false;     /* --seed given: every new game starts from g_seed */
+static uint64_t g_seed = 0;
+static int g_standby = -1;          /* our standbys[] entry, -1 = not registered */
+static uint32_t g_standby_rank = 0;   /* live standbys ahead of us */
+static uint32_t g_standby_count = 0;  /* live standbys including us */
+
+/* Futex wakeups of waiters on the same host */
+static bool g_wake_pending = false;   /* wake_seq bumped since the last flush */
+static int g_wake_efd = -1;           /* eventfd signalled by the wake thread */
+static pthread_t g_wake_thread;
+static atomic_bool g_wake_stop = false;
+static uint64_t g_lease = 0;        /* lease word we hold, 0 = none */
+static uint32_t g_handoff_target = 0;   /* standby we asked to take over, 0 = none */
+static uint64_t g_handoff_start = 0;    /* when the handoff was requested */
+static uint32_t g_handoff_phase_ms = 0; /* tick phase inherited through a handoff */
+static bool g_handoff_accepted = false; /* we accepted a handoff not yet committed */
+static uint32_t g_fence_events = 0;     /* times we were fenced, not yet folded into the stats */
+
+/* Failover timing, all in ms */
+static uint32_t g_heartbeat_ms = HEARTBEAT_INTERVAL_MS;
+static uint32_t g_check_ms = 0;           /* waiter check period, 0 = half the owner's heartbeat */
+static uint32_t g_probe_ms = 0;           /* startup probe, 0 = lease plus one heartbeat */
+static uint32_t g_takeover_delay_ms = TAKEOVER_DELAY_MS;
+static uint32_t g_spectator_ms = 1000 / SPECTATOR_FPS;  /* waiting screen frame period */
+static const MemBackend *g_mem_backend = NULL;  /* selected by setup_backend() */
+static const char *g_mem_backend_name = NULL;   /* NULL = from the path */
+static const char *g_mem_file = NULL;      /* mmap file path, NULL = backend default */
+static off_t g_mem_offset = -1;            /* mmap offset, -1 = backend default */
+static void *g_region = NULL;     /* start of the mapping */
+static size_t g_map_len = 0;      /* mapped length */
+static SessionDirectory *g_dir = NULL;  /* multi-session directory, if any */
+static long long g_session_id = -1;     /* -1 = single-session region */
+static uint32_t g_max_sessions = DEFAULT_SESSIONS;
+static int g_session_cmd = SESSION_CMD_NONE;
+static bool g_prefault = false;   /* populate and lock the mapping at attach */
+static bool g_hugepages = false;  /* back the mapping with huge pages */
+static Cell g_frame[SCREEN_HEIGHT][SCREEN_WIDTH];  /* frame being composed */
+static Cell g_shown[SCREEN_HEIGHT][SCREEN_WIDTH];  /* frame on the terminal */
+static uint64_t g_dirty_lines[(STATE_LINES + 63) / 64];  /* 1 bit per cache line */
+static const FlushBackend *g_flush = NULL;  /* selected by setup_flush() */
+static const char *g_flush_name = "auto";
+static size_t g_cbo_block = CACHE_LINE_SIZE;  /* cache block size for CPU flushes */
+static int g_move_tfd = -1;       /* snake move tick / handoff commit poll */
+static int g_heartbeat_tfd = -1;  /* heartbeat publish / liveness check */
+static int g_render_tfd = -1;     /* next frame deadline */
+static unsigned char g_in_buf[64];  /* raw stdin bytes not yet decoded */
+static size_t g_in_len = 0;
+static size_t g_in_pos = 0;
+static int g_esc_state = ESC_NONE;
+static char g_out_buf[OUT_BUF_SIZE];   /* pending terminal output */
+static size_t g_out_len = 0;
+static const char *const g_color_codes[] = {
+    COLOR_RESET, COLOR_WHITE, COLOR_CYAN, COLOR_YELLOW,
+    COLOR_GREEN, COLOR_BRIGHT_GREEN, COLOR_RED
+};
 
 /* Function prototypes */
 static void cleanup(void);
@@ -89,22 +516,107 @@ static void signal_handler(int sig);
 static void setup_signals(void);
 static void enable_raw_mode(void);
 static void disable_raw_mode(void);
+static int setup_backend(void);
 static int setup_mmap(void);
+static int map_region(size_t len);
+static void unmap_region(void);
+static void region_flush(const void *addr, size_t len);
+static size_t session_region_size(uint32_t count, uint32_t slot_size, uint64_t *slots_offset);
+static int format_directory(void);
+static int map_sessions(void);
+static GameState *session_state(uint32_t slot);
+static uint32_t slot_settled_state(SessionSlot *slot);
+static int session_find(uint32_t id);
+static int session_attach(void);
+static int run_session_command(void);
+static bool session_running(void);
+static bool owner_running(void);
+static int attach_state(size_t avail);
+static void format_state(void);
+static int migrate_legacy_state(void);
+static int migrate_v2_state(void);
+static int migrate_v4_state(void);
+static bool older_build_running(const void *heartbeat);
+static bool body_load(const Point *segs, uint32_t count);
+static void state_mark_dirty(const void *addr, size_t len);
+static void state_flush(void);
+static void state_invalidate(const void *addr, size_t len);
+static int setup_flush(void);
+static bool state_write_begin(void);
+static void state_write_end(void);
+static uint64_t lease_read(void);
+static bool lease_claim(uint64_t seen);
+static void lease_take(uint64_t lease);
+static void handoff_request(void);
+static void handoff_step(uint64_t last_move);
+static bool handoff_answer(void);
+static bool lease_held(void);
+static void lease_lost(void);
+static uint32_t fence_total(GameState *gs);
+static bool owner_check(void);
+static void lease_release(void);
+static bool claim_at_startup(void);
+static uint32_t hash_node_id(void);
+static bool standby_live(StandbySlot *slot, uint64_t now);
+static bool standby_before(const StandbySlot *a, const StandbySlot *b);
+static void standby_join(void);
+static void standby_leave(void);
+static void standby_check(void);
+static uint32_t standby_best(void);
+static uint32_t owner_heartbeat_ms(void);
+static uint64_t lease_duration_ms(void);
+static void detector_reset(FailureDetector *fd);
+static bool detector_observe(FailureDetector *fd);
+static uint64_t detector_timeout_ms(const FailureDetector *fd);
+static void state_write_recover(void);
+static bool state_consistent(void);
+static void snapshot_copy(GameSnapshot *snap);
+static bool state_snapshot(GameSnapshot *snap);
+static void heartbeat_publish(void);
+static void takeover_pause(void);
+static uint64_t heartbeat_read(void);
 static void init_game(void);
 static void spawn_food(void);
+static void rng_seed(uint64_t seed);
+static uint32_t rng_next(void);
+static uint32_t rng_bounded(uint32_t bound);
 static void move_snake(void);
-static bool check_collision(void);
+static bool check_collision(Point head);
+static Point snake_head(void);
+static Point point_step(Point p, uint32_t dir);
+static uint32_t body_step(uint32_t index);
+static void body_set_step(uint32_t index, uint32_t dir);
+static bool occupancy_test(const uint32_t *occupancy, int x, int y);
+static bool cell_occupied(int x, int y);
+static void cell_set(int x, int y);
+static void cell_clear(int x, int y);
 static void handle_input(void);
 static void render(void);
 static void render_waiting(void);
 static int get_move_interval(void);
 static uint64_t get_time_ms(void);
+static uint64_t get_realtime_ms(void);
 static void clear_screen(void);
 static void hide_cursor(void);
 static void show_cursor(void);
 static void move_cursor(int row, int col);
-static int kbhit(void);
-static int getch(void);
+static void out_write(const char *data, size_t len);
+static void out_str(const char *str);
+static void out_flush(void);
+static void frame_clear(void);
+static int frame_text(int row, int col, uint8_t color, const char *fmt, ...);
+static void frame_present(void);
+static int read_key(void);
+static int setup_timers(void);
+static void state_wake(void);
+static long futex(_Atomic uint32_t *word, int op, uint32_t val, const struct timespec *timeout);
+static void *wake_thread(void *arg);
+static bool wake_start(void);
+static void wake_stop(void);
+static bool wake_usable(void);
+static void wake_drain(void);
+static void timer_arm(int fd, uint64_t first_ms, uint64_t period_ms);
+static bool timer_expired(int fd);
 
 /* Get current time in milliseconds */
 static uint64_t get_time_ms(void) {
@@ -113,45 +625,218 @@ static uint64_t get_time_ms(void) {
     return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
 }
 
+/* Get wall clock time in milliseconds, comparable between nodes */
+static uint64_t get_realtime_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
 /* Clear screen */
 static void clear_screen(void) {
-    printf("\033[2J\033[H");
-    fflush(stdout);
+    out_str("\033[2J\033[H");
+    out_flush();
+
+    /* The terminal is blank now; the next frame is diffed against that */
+    for (int row = 0; row < SCREEN_HEIGHT; row++) {
+        for (int col = 0; col < SCREEN_WIDTH; col++) {
+            g_shown[row][col] = (Cell){' ', CLR_DEFAULT};
+        }
+    }
 }
 
 /* Hide cursor */
 static void hide_cursor(void) {
-    printf("\033[?25l");
-    fflush(stdout);
+    out_str("\033[?25l");
+    out_flush();
 }
 
 /* Show cursor */
 static void show_cursor(void) {
-    printf("\033[?25h");
-    fflush(stdout);
+    out_str("\033[?25h");
+    out_flush();
 }
 
 /* Move cursor to position */
 static void move_cursor(int row, int col) {
-    printf("\033[%d;%dH", row, col);
+    char seq[16];
+    int len = snprintf(seq, sizeof(seq), "\033[%d;%dH", row, col);
+    out_write(seq, (size_t)len);
 }
 
-/* Check if key is available */
-static int kbhit(void) {
-    struct timeval tv = {0, 0};
-    fd_set fds;
-    FD_ZERO(&fds);
-    FD_SET(STDIN_FILENO, &fds);
-    return select(STDIN_FILENO + 1, &fds, NULL, NULL, &tv) > 0;
+/* Append bytes to the output buffer, flushing first if they do not fit */
+static void out_write(const char *data, size_t len) {
+    if (g_out_len + len > sizeof(g_out_buf)) {
+        out_flush();
+    }
+    memcpy(g_out_buf + g_out_len, data, len);
+    g_out_len += len;
+}
+
+/* Append a string to the output buffer */
+static void out_str(const char *str) {
+    out_write(str, strlen(str));
 }
 
-/* Get character without blocking */
-static int getch(void) {
-    unsigned char c;
-    if (read(STDIN_FILENO, &c, 1) == 1) {
-        return c;
+/* Write the output buffer to the terminal with as few write(2) calls as
+ * the kernel allows (one in practice) */
+static void out_flush(void) {
+    size_t done = 0;
+
+    while (done < g_out_len) {
+        ssize_t n = write(STDOUT_FILENO, g_out_buf + done, g_out_len - done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        done += (size_t)n;
     }
-    return -1;
+    g_out_len = 0;
+}
+
+/* Reset the frame being composed to blanks */
+static void frame_clear(void) {
+    for (int row = 0; row < SCREEN_HEIGHT; row++) {
+        for (int col = 0; col < SCREEN_WIDTH; col++) {
+            g_frame[row][col] = (Cell){' ', CLR_DEFAULT};
+        }
+    }
+}
+
+/* Write formatted text into the frame (0-based), return the next column */
+static int frame_text(int row, int col, uint8_t color, const char *fmt, ...) {
+    char text[SCREEN_WIDTH + 1];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(text, sizeof(text), fmt, ap);
+    va_end(ap);
+
+    for (const char *p = text; *p != '\0' && col < SCREEN_WIDTH; p++, col++) {
+        g_frame[row][col] = (Cell){*p, color};
+    }
+    return col;
+}
+
+/* Emit only the cells that differ from what the terminal already shows.
+ * SGR codes are only written when the color changes between emitted cells,
+ * and the whole update goes out in a single write. */
+static void frame_present(void) {
+    int cursor_row = -1;
+    int cursor_col = -1;
+    uint8_t color = CLR_DEFAULT;  /* every frame ends with attributes reset */
+
+    for (int row = 0; row < SCREEN_HEIGHT; row++) {
+        for (int col = 0; col < SCREEN_WIDTH; col++) {
+            Cell cell = g_frame[row][col];
+            if (cell.ch == g_shown[row][col].ch &&
+                cell.color == g_shown[row][col].color) {
+                continue;
+            }
+
+            if (row == cursor_row && col > cursor_col &&
+                col - cursor_col <= 4) {
+                /* A short run of unchanged blanks is cheaper to rewrite
+                 * than to skip with a cursor move */
+                int gap = cursor_col;
+                while (gap < col && g_shown[row][gap].ch == ' ') gap++;
+                if (gap == col) {
+                    out_write("    ", (size_t)(col - cursor_col));
+                } else {
+                    move_cursor(row + 1, col + 1);
+                }
+            } else if (row != cursor_row || col != cursor_col) {
+                move_cursor(row + 1, col + 1);
+            }
+            /* Blanks look the same in any foreground color */
+            if (cell.color != color && cell.ch != ' ') {
+                out_str(g_color_codes[cell.color]);
+                color = cell.color;
+            }
+            out_write(&cell.ch, 1);
+            g_shown[row][col] = cell;
+
+            /* Writing the last column leaves the cursor in a pending-wrap
+             * state, so force an explicit move for the next cell */
+            cursor_row = row;
+            cursor_col = (col + 1 < SCREEN_WIDTH) ? col + 1 : -1;
+        }
+    }
+
+    if (color != CLR_DEFAULT) {
+        out_str(COLOR_RESET);
+    }
+    out_flush();
+}
+
+/* Get the next decoded key without blocking, or -1 if none is buffered.
+ * Arrow key escape sequences are returned as KEY_UP..KEY_RIGHT. */
+static int read_key(void) {
+    for (;;) {
+        if (g_in_pos == g_in_len) {
+            ssize_t n = read(STDIN_FILENO, g_in_buf, sizeof(g_in_buf));
+            if (n <= 0) {
+                /* A lone ESC with nothing after it was just the ESC key */
+                if (g_esc_state == ESC_START) g_esc_state = ESC_NONE;
+                return -1;
+            }
+            g_in_len = (size_t)n;
+            g_in_pos = 0;
+        }
+
+        int c = g_in_buf[g_in_pos++];
+
+        switch (g_esc_state) {
+            case ESC_NONE:
+                if (c == 27) {
+                    g_esc_state = ESC_START;
+                    continue;
+                }
+                return c;
+            case ESC_START:
+                g_esc_state = (c == '[') ? ESC_CSI : ESC_NONE;
+                continue;
+            case ESC_CSI:
+                g_esc_state = ESC_NONE;
+                switch (c) {
+                    case 'A': return KEY_UP;
+                    case 'B': return KEY_DOWN;
+                    case 'C': return KEY_RIGHT;
+                    case 'D': return KEY_LEFT;
+                }
+                continue;  /* Unsupported sequence, drop it */
+        }
+    }
+}
+
+/* Create the main loop timers */
+static int setup_timers(void) {
+    g_move_tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    g_heartbeat_tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    g_render_tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (g_move_tfd == -1 || g_heartbeat_tfd == -1 || g_render_tfd == -1) {
+        perror("timerfd_create");
+        return -1;
+    }
+    return 0;
+}
+
+/* Arm a timer to fire after first_ms and then every period_ms
+ * (period 0 = one-shot, first 0 = disarm) */
+static void timer_arm(int fd, uint64_t first_ms, uint64_t period_ms) {
+    struct itimerspec its;
+    its.it_value.tv_sec = first_ms / 1000;
+    its.it_value.tv_nsec = (first_ms % 1000) * 1000000;
+    its.it_interval.tv_sec = period_ms / 1000;
+    its.it_interval.tv_nsec = (period_ms % 1000) * 1000000;
+    timerfd_settime(fd, 0, &its, NULL);
+}
+
+/* Consume a timer's expirations, return true if it fired */
+static bool timer_expired(int fd) {
+    uint64_t expirations;
+    return read(fd, &expirations, sizeof(expirations)) == sizeof(expirations) &&
+           expirations > 0;
 }
 
 /* Signal handler */
@@ -170,96 +855,1770 @@ static void setup_signals(void) {
     sigaction(SIGTERM, &sa, NULL);
 }
 
-/* Enable raw terminal mode */
-static void enable_raw_mode(void) {
-    if (tcgetattr(STDIN_FILENO, &g_orig_termios) == -1) {
-        perror("tcgetattr");
-        exit(1);
+/* Enable raw terminal mode */
+static void enable_raw_mode(void) {
+    if (tcgetattr(STDIN_FILENO, &g_orig_termios) == -1) {
+        perror("tcgetattr");
+        exit(1);
+    }
+    g_terminal_raw = true;
+
+    struct termios raw = g_orig_termios;
+    raw.c_lflag &= ~(ECHO | ICANON | ISIG);
+    raw.c_iflag &= ~(IXON | ICRNL);
+    raw.c_cc[VMIN] = 0;
+    raw.c_cc[VTIME] = 0;
+
+    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1) {
+        perror("tcsetattr");
+        exit(1);
+    }
+}
+
+/* Disable raw terminal mode */
+static void disable_raw_mode(void) {
+    if (g_terminal_raw) {
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &g_orig_termios);
+        g_terminal_raw = false;
+    }
+}
+
+/* Cleanup function */
+static void cleanup(void) {
+    if (g_terminal_raw) {
+        show_cursor();
+        disable_raw_mode();
+        clear_screen();
+    }
+
+    wake_stop();
+
+    if (g_state != NULL) {
+        standby_leave();
+        lease_release();
+        state_flush();
+        g_state = NULL;
+    }
+
+    unmap_region();
+
+    if (g_move_tfd != -1) close(g_move_tfd);
+    if (g_heartbeat_tfd != -1) close(g_heartbeat_tfd);
+    if (g_render_tfd != -1) close(g_render_tfd);
+    g_move_tfd = g_heartbeat_tfd = g_render_tfd = -1;
+    if (g_wake_efd != -1) close(g_wake_efd);
+    g_wake_efd = -1;
+}
+
+/* Mark the cache lines covering [addr, addr + len) of the shared state */
+static void state_mark_dirty(const void *addr, size_t len) {
+    size_t start = (size_t)((const char *)addr - (const char *)g_state);
+    size_t first = start / CACHE_LINE_SIZE;
+    size_t last = (start + len - 1) / CACHE_LINE_SIZE;
+
+    for (size_t line = first; line <= last; line++) {
+        g_dirty_lines[line / 64] |= 1ull << (line % 64);
+    }
+}
+
+/* Write back the dirty cache lines of the shared state through the flush
+ * backend, one call per run of adjacent dirty lines */
+static void state_flush(void) {
+    const size_t control = offsetof(GameState, seq) / CACHE_LINE_SIZE;
+    bool control_dirty = g_dirty_lines[control / 64] & (1ull << (control % 64));
+    size_t run_start = 0;
+    size_t run_len = 0;
+
+    /* Memory must never hold a new seq over old game data. The control
+     * block (seq, head, tail) goes out with an odd seq before the other
+     * lines and with the final seq after them, so a reader on another
+     * node rejects a half-written update, and an owner that dies midway
+     * leaves an odd seq for state_write_recover() to find. */
+    g_dirty_lines[control / 64] &= ~(1ull << (control % 64));
+    uint32_t seq = atomic_load_explicit(&g_state->seq, memory_order_relaxed);
+    bool others_dirty = false;
+    for (size_t i = 0; i < sizeof(g_dirty_lines) / sizeof(g_dirty_lines[0]); i++) {
+        others_dirty |= g_dirty_lines[i] != 0;
+    }
+    bool bracket = control_dirty && others_dirty && !(seq & 1);
+    if (bracket) {
+        atomic_store_explicit(&g_state->seq, seq - 1, memory_order_relaxed);
+        g_flush->clean((char *)g_state + control * CACHE_LINE_SIZE, CACHE_LINE_SIZE);
+        g_flush->drain();
+    }
+
+    for (size_t line = 0; line < STATE_LINES; line++) {
+        if (g_dirty_lines[line / 64] & (1ull << (line % 64))) {
+            if (run_len == 0) run_start = line;
+            run_len++;
+            continue;
+        }
+        if (run_len != 0) {
+            g_flush->clean((char *)g_state + run_start * CACHE_LINE_SIZE,
+                           run_len * CACHE_LINE_SIZE);
+            run_len = 0;
+        }
+    }
+
+    if (run_len != 0) {
+        g_flush->clean((char *)g_state + run_start * CACHE_LINE_SIZE,
+                       run_len * CACHE_LINE_SIZE);
+    }
+    g_flush->drain();
+    memset(g_dirty_lines, 0, sizeof(g_dirty_lines));
+
+    if (bracket) {
+        atomic_store_explicit(&g_state->seq, seq, memory_order_release);
+    }
+    if (control_dirty) {
+        g_flush->clean((char *)g_state + control * CACHE_LINE_SIZE, CACHE_LINE_SIZE);
+        g_flush->drain();
+    }
+
+    /* Wake sleeping waiters only once what they will read is visible */
+    if (g_wake_pending) {
+        g_wake_pending = false;
+        uint32_t until = atomic_load_explicit(&g_state->wake_until, memory_order_acquire);
+        if ((int32_t)(until - (uint32_t)get_time_ms()) >= 0) {
+            futex(&g_state->wake_seq, FUTEX_WAKE, INT_MAX, NULL);
+        }
+    }
+}
+
+/* Note an event waiters watch for (handoff request, lease release, score
+ * or game state change); the futex wake goes out with the next flush */
+static void state_wake(void) {
+    atomic_fetch_add_explicit(&g_state->wake_seq, 1, memory_order_release);
+    STATE_DIRTY(wake_seq);
+    g_wake_pending = true;
+}
+
+static long futex(_Atomic uint32_t *word, int op, uint32_t val, const struct timespec *timeout) {
+    return syscall(SYS_futex, word, op, val, timeout, NULL, 0);
+}
+
+/* Block on the wake futex and turn each wakeup into an eventfd event for
+ * the poll loop. The wait is bounded so wake_stop() cannot miss it.
+ * Before each wait the thread pushes wake_until out to the end of that
+ * wait (an atomic maximum, as several waiters share it). The active only
+ * pays for FUTEX_WAKE while the deadline lies ahead, and a waiter that
+ * was killed stops counting once its last wait would have timed out. */
+static void *wake_thread(void *arg) {
+    const struct timespec timeout = { WAKE_WAIT_MS / 1000, (WAKE_WAIT_MS % 1000) * 1000000 };
+    uint64_t one = 1;
+    (void)arg;
+
+    while (!atomic_load(&g_wake_stop)) {
+        uint32_t seen = atomic_load_explicit(&g_state->wake_seq, memory_order_acquire);
+        uint32_t until = (uint32_t)get_time_ms() + WAKE_WAIT_MS;
+        uint32_t current = atomic_load_explicit(&g_state->wake_until, memory_order_relaxed);
+        while ((int32_t)(until - current) > 0 &&
+               !atomic_compare_exchange_weak_explicit(&g_state->wake_until, &current, until,
+                                                      memory_order_acq_rel,
+                                                      memory_order_relaxed)) {
+        }
+        long ret = futex(&g_state->wake_seq, FUTEX_WAIT, seen, &timeout);
+
+        if (ret == 0 || (ret == -1 && errno == EAGAIN)) {
+            if (write(g_wake_efd, &one, sizeof(one)) < 0) break;
+        }
+    }
+    return NULL;
+}
+
+/* Start the wake thread if futexes work on this mapping. They do for
+ * page-backed memory (files, shm, memfd, hugetlbfs) but not for device
+ * memory such as a /dev/mem window, where waiters keep polling. */
+static bool wake_start(void) {
+    if (g_wake_efd != -1) {
+        return true;
+    }
+    if (futex(&g_state->wake_seq, FUTEX_WAKE, 0, NULL) == -1) {
+        return false;
+    }
+
+    g_wake_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (g_wake_efd == -1) {
+        return false;
+    }
+    if (pthread_create(&g_wake_thread, NULL, wake_thread, NULL) != 0) {
+        close(g_wake_efd);
+        g_wake_efd = -1;
+        return false;
+    }
+    return true;
+}
+
+/* Check whether this waiter can sleep on the wake futex: the active must
+ * be on this host for its FUTEX_WAKE to reach us */
+static bool wake_usable(void) {
+    STATE_INVALIDATE(owner_node);
+    return g_state->owner_node == g_node_id && wake_start();
+}
+
+/* Consume pending wakeups of the wake thread */
+static void wake_drain(void) {
+    uint64_t count;
+    if (g_wake_efd != -1 && read(g_wake_efd, &count, sizeof(count)) < 0) {
+        /* none pending */
+    }
+}
+
+/* Stop the wake thread, when we become active, when the owner moves to
+ * another host or before the region is unmapped; wake_start() can start
+ * it again */
+static void wake_stop(void) {
+    if (g_wake_efd == -1) {
+        return;
+    }
+    atomic_store(&g_wake_stop, true);
+    futex(&g_state->wake_seq, FUTEX_WAKE, INT_MAX, NULL);
+    pthread_join(g_wake_thread, NULL);
+    close(g_wake_efd);
+    g_wake_efd = -1;
+    atomic_store(&g_wake_stop, false);
+}
+
+/* Make the next reads of [addr, addr + len) fetch what other nodes wrote */
+static void state_invalidate(const void *addr, size_t len) {
+    g_flush->invalidate(addr, len);
+    g_flush->drain();
+}
+
+/* msync backend: page granular, pending ranges are merged until drained */
+static char *g_msync_start = NULL;
+static char *g_msync_end = NULL;
+
+static bool msync_probe(void) {
+    return true;
+}
+
+static void msync_drain(void) {
+    if (g_msync_start != NULL) {
+        msync(g_msync_start, (size_t)(g_msync_end - g_msync_start), MS_SYNC);
+        g_msync_start = g_msync_end = NULL;
+    }
+}
+
+static void msync_clean(const void *addr, size_t len) {
+    const uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    char *start = (char *)((uintptr_t)addr & ~(page - 1));
+    char *end = (char *)(((uintptr_t)addr + len + page - 1) & ~(page - 1));
+
+    if (g_msync_start != NULL && start <= g_msync_end) {
+        g_msync_end = end > g_msync_end ? end : g_msync_end;
+        return;
+    }
+    msync_drain();
+    g_msync_start = start;
+    g_msync_end = end;
+}
+
+/* A coherent mapping needs no invalidation, and msync cannot express one */
+static void msync_invalidate(const void *addr, size_t len) {
+    (void)addr;
+    (void)len;
+}
+
+/* none backend: the mapping is coherent host memory */
+static bool none_probe(void) {
+    return true;
+}
+
+static void none_range(const void *addr, size_t len) {
+    (void)addr;
+    (void)len;
+}
+
+static void none_drain(void) {
+}
+
+/* Iterate p over every cache block touching [addr, addr + len) */
+#define FOR_EACH_CACHE_BLOCK(addr, len, p) \
+    for (uintptr_t p = (uintptr_t)(addr) & ~(uintptr_t)(g_cbo_block - 1); \
+         p < (uintptr_t)(addr) + (len); p += g_cbo_block)
+
+#if defined(__x86_64__) || defined(__i386__)
+/* x86 backends: CLWB writes back and keeps the line, CLFLUSHOPT writes back
+ * and evicts it. Both are weakly ordered and completed by SFENCE. */
+static bool x86_has_feature(unsigned int ebx_bit) {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+    return (ebx >> ebx_bit) & 1;
+}
+
+/* The clwb backend invalidates with CLFLUSHOPT (CLWB may keep the line),
+ * so it needs both instructions */
+static bool clwb_probe(void) {
+    return x86_has_feature(24) && x86_has_feature(23);
+}
+
+static bool clflushopt_probe(void) {
+    return x86_has_feature(23);
+}
+
+static void clwb_range(const void *addr, size_t len) {
+    FOR_EACH_CACHE_BLOCK(addr, len, p) {
+        __asm__ volatile("clwb %0" : "+m"(*(volatile char *)p));
+    }
+}
+
+static void clflushopt_range(const void *addr, size_t len) {
+    FOR_EACH_CACHE_BLOCK(addr, len, p) {
+        __asm__ volatile("clflushopt %0" : "+m"(*(volatile char *)p));
+    }
+}
+
+static void x86_drain(void) {
+    __asm__ volatile("sfence" ::: "memory");
+}
+#endif
+
+#if defined(__riscv)
+/* RISC-V Zicbom backend. The instructions are emitted with .insn so the
+ * build does not depend on the assembler knowing the extension; user mode
+ * access depends on the kernel enabling it, which the probe checks. */
+static sigjmp_buf g_probe_jmp;
+
+static void probe_sigill(int sig) {
+    (void)sig;
+    siglongjmp(g_probe_jmp, 1);
+}
+
+static void cbo_clean(uintptr_t p) {
+    __asm__ volatile(".insn i 0x0F, 2, x0, %0, 1" :: "r"(p) : "memory");
+}
+
+static void cbo_flush(uintptr_t p) {
+    __asm__ volatile(".insn i 0x0F, 2, x0, %0, 2" :: "r"(p) : "memory");
+}
+
+static bool zicbom_probe(void) {
+    struct sigaction sa, old;
+    volatile char target[CACHE_LINE_SIZE * 2];
+    volatile bool ok = false;
+
+    /* Block size comes from the device tree, default to a cache line */
+    FILE *f = fopen("/proc/device-tree/cpus/cpu@0/riscv,cbom-block-size", "rb");
+    if (f != NULL) {
+        unsigned char be[4];
+        if (fread(be, 1, sizeof(be), f) == sizeof(be)) {
+            size_t block = ((size_t)be[0] << 24) | ((size_t)be[1] << 16) |
+                           ((size_t)be[2] << 8) | be[3];
+            if (block >= 16 && (block & (block - 1)) == 0) g_cbo_block = block;
+        }
+        fclose(f);
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = probe_sigill;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGILL, &sa, &old);
+    if (sigsetjmp(g_probe_jmp, 1) == 0) {
+        cbo_clean((uintptr_t)target);
+        ok = true;
+    }
+    sigaction(SIGILL, &old, NULL);
+    return ok;
+}
+
+static void zicbom_clean(const void *addr, size_t len) {
+    FOR_EACH_CACHE_BLOCK(addr, len, p) {
+        cbo_clean(p);
+    }
+}
+
+/* cbo.flush rather than cbo.inval: same effect on clean lines, and it can
+ * never discard a write this node has not flushed yet */
+static void zicbom_invalidate(const void *addr, size_t len) {
+    FOR_EACH_CACHE_BLOCK(addr, len, p) {
+        cbo_flush(p);
+    }
+}
+
+static void zicbom_drain(void) {
+    __asm__ volatile("fence rw, rw" ::: "memory");
+}
+#endif
+
+/* Flush backends in order of preference for "auto" */
+static const FlushBackend g_flush_backends[] = {
+#if defined(__riscv)
+    { "zicbom", zicbom_probe, zicbom_clean, zicbom_invalidate, zicbom_drain },
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+    { "clwb", clwb_probe, clwb_range, clflushopt_range, x86_drain },
+    { "clflushopt", clflushopt_probe, clflushopt_range, clflushopt_range, x86_drain },
+#endif
+    { "msync", msync_probe, msync_clean, msync_invalidate, msync_drain },
+    { "none", none_probe, none_range, none_range, none_drain },
+};
+
+/* Select the flush backend named by g_flush_name. "auto" uses the memory
+ * backend's choice, or the best the CPU supports for physical memory. */
+static int setup_flush(void) {
+    size_t count = sizeof(g_flush_backends) / sizeof(g_flush_backends[0]);
+    bool automatic = strcmp(g_flush_name, "auto") == 0;
+
+    if (automatic && g_mem_backend->auto_flush != NULL) {
+        g_flush_name = g_mem_backend->auto_flush;
+        automatic = false;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const FlushBackend *backend = &g_flush_backends[i];
+        if (!automatic && strcmp(g_flush_name, backend->name) != 0) {
+            continue;
+        }
+        if (backend->probe()) {
+            g_flush = backend;
+            return 0;
+        }
+        if (!automatic) {
+            fprintf(stderr, "Flush backend %s is not supported on this CPU\n", backend->name);
+            return -1;
+        }
+    }
+
+    fprintf(stderr, "Unknown flush backend for this build: %s\n", g_flush_name);
+    return -1;
+}
+
+/* Open a write section: readers retry while the sequence count is odd.
+ * The fence keeps the odd count ahead of the data stores that follow.
+ * A count left odd by a dead writer still moves, so readers that copied
+ * data during its half-finished update see a change. Fails, demoting
+ * this process, if another process has claimed the lease. */
+static bool state_write_begin(void) {
+    if (!lease_held()) {
+        lease_lost();
+        return false;
+    }
+
+    uint32_t seq = atomic_load_explicit(&g_state->seq, memory_order_relaxed);
+    atomic_store_explicit(&g_state->seq, (seq + 1) | 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&g_state->owner_stamp, g_lease, memory_order_relaxed);
+    STATE_DIRTY(owner_stamp);
+    return true;
+}
+
+/* Close a write section, publishing the data stores made inside it */
+static void state_write_end(void) {
+    uint32_t seq = atomic_load_explicit(&g_state->seq, memory_order_relaxed);
+    atomic_store_explicit(&g_state->seq, seq + 1, memory_order_release);
+    STATE_DIRTY(seq);
+}
+
+/* Close a write section left open by a process that died mid-update */
+static void state_write_recover(void) {
+    if (atomic_load_explicit(&g_state->seq, memory_order_relaxed) & 1) {
+        /* A flush cut short can leave the data half written back; a body
+         * that no longer leads from tail to head is not worth resuming */
+        if (!state_consistent()) {
+            fprintf(stderr, "Shared state was torn by a crash, starting a new game\n");
+            init_game();
+            return;
+        }
+        state_write_end();
+    }
+}
+
+/* Check that the body walks from the tail to the head over occupied cells
+ * and that the occupancy bitmap covers nothing else */
+static bool state_consistent(void) {
+    uint32_t length = g_state->snake_length;
+    if (length == 0) return true;
+    if (length > MAX_SNAKE_LEN || g_state->body_tail >= MAX_SNAKE_LEN) return false;
+
+    Point p = { g_state->tail_x, g_state->tail_y };
+    for (uint32_t i = 0; ; i++) {
+        if (p.x < 0 || p.x >= BOARD_WIDTH || p.y < 0 || p.y >= BOARD_HEIGHT ||
+            !cell_occupied(p.x, p.y)) {
+            return false;
+        }
+        if (i == length - 1) break;
+        p = point_step(p, body_step(g_state->body_tail + i));
+    }
+    if (p.x != g_state->head_x || p.y != g_state->head_y) return false;
+
+    uint32_t covered = 0;
+    for (uint32_t w = 0; w < OCCUPANCY_WORDS; w++) {
+        covered += (uint32_t)__builtin_popcount(g_state->occupancy[w]);
+    }
+    return covered == length;
+}
+
+/* Copy the game data a view needs; consistent only for the writer or
+ * inside a seqlock read */
+static void snapshot_copy(GameSnapshot *snap) {
+    snap->game_state = g_state->game_state;
+    snap->score = g_state->score;
+    snap->high_score = g_state->high_score;
+    snap->snake_length = g_state->snake_length;
+    snap->fence_events = fence_total(g_state);
+    snap->food_x = g_state->food_x;
+    snap->food_y = g_state->food_y;
+    snap->head = (Point){ g_state->head_x, g_state->head_y };
+    memcpy(snap->occupancy, g_state->occupancy, sizeof(snap->occupancy));
+}
+
+/* Take a consistent copy of the game data without blocking the writer.
+ * Returns false if the writer stayed mid-update for too long. */
+static bool state_snapshot(GameSnapshot *snap) {
+    for (int attempt = 0; attempt < SNAPSHOT_RETRIES; attempt++) {
+        STATE_INVALIDATE(seq);
+        uint32_t seq = atomic_load_explicit(&g_state->seq, memory_order_acquire);
+        if (seq & 1) {
+            sched_yield();
+            continue;
+        }
+
+        /* Fetch the lines the copy below reads (the active control block
+         * was just invalidated along with seq) */
+        STATE_INVALIDATE(score);
+        STATE_INVALIDATE(occupancy);
+
+        snapshot_copy(snap);
+
+        atomic_thread_fence(memory_order_acquire);
+        STATE_INVALIDATE(seq);
+        if (atomic_load_explicit(&g_state->seq, memory_order_relaxed) == seq) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Read the lease word */
+static uint64_t lease_read(void) {
+    STATE_INVALIDATE(lease);
+    return atomic_load_explicit(&g_state->lease, memory_order_acquire);
+}
+
+/* Take the lease over from the holder seen as `seen`, starting a new
+ * epoch. Fails if anyone else claimed it since, so of several processes
+ * seeing the same expired lease exactly one becomes active. */
+static bool lease_claim(uint64_t seen) {
+    uint64_t next = ((uint64_t)(LEASE_EPOCH(seen) + 1) << 32) | g_owner_id;
+
+    if (!atomic_compare_exchange_strong_explicit(&g_state->lease, &seen, next,
+                                                 memory_order_acq_rel,
+                                                 memory_order_acquire)) {
+        return false;
+    }
+    lease_take(next);
+    return true;
+}
+
+/* Start acting as the owner of a lease we now hold */
+static void lease_take(uint64_t lease) {
+    g_lease = lease;
+    standby_leave();
+    g_state->feature_flags = FEATURES_KNOWN;
+    STATE_DIRTY(feature_flags);
+    atomic_store_explicit(&g_state->owner_stamp, lease, memory_order_release);
+    STATE_DIRTY(owner_stamp);
+    g_state->heartbeat_time = get_realtime_ms();
+    STATE_DIRTY(heartbeat_time);
+    g_state->lease_ticks = LEASE_TICKS;
+    g_state->heartbeat_ms = g_heartbeat_ms;
+    g_state->owner_node = g_node_id;
+    STATE_DIRTY(lease);
+    STATE_DIRTY(lease_ticks);
+    STATE_DIRTY(heartbeat_ms);
+    STATE_DIRTY(owner_node);
+    if (g_fence_events != 0) {
+        g_state->fence_events += g_fence_events;
+        STATE_DIRTY(fence_events);
+        g_fence_events = 0;
+    }
+    state_flush();
+}
+
+/* Ask the first standby in handoff order to take over. We keep driving
+ * the game until it accepts. */
+static void handoff_request(void) {
+    uint32_t target = standby_best();
+
+    if (target == 0 || g_handoff_target != 0) {
+        return;
+    }
+    atomic_store_explicit(&g_state->takeover_request, target, memory_order_release);
+    STATE_DIRTY(takeover_request);
+    state_wake();
+    g_handoff_target = target;
+    g_handoff_start = get_time_ms();
+}
+
+/* Advance a pending handoff at the start of an active tick. Once the
+ * target has accepted, publish the tick phase and everything written so
+ * far, then move the lease to the target in one compare-and-swap: there
+ * is never a moment with no owner or two. Aborts if the target does not
+ * accept in time. */
+static void handoff_step(uint64_t last_move) {
+    uint32_t target = g_handoff_target;
+    bool accepted = false;
+
+    STATE_INVALIDATE(standbys);
+    for (int i = 0; i < MAX_STANDBYS && !accepted; i++) {
+        StandbySlot *slot = &g_state->standbys[i];
+        accepted = atomic_load_explicit(&slot->owner_id, memory_order_relaxed) == target &&
+                   atomic_load_explicit(&slot->handoff_accept, memory_order_acquire) == target;
+    }
+    if (accepted) {
+        uint64_t phase = get_time_ms() - last_move;
+        g_state->handoff_phase_ms = (uint32_t)(phase < UINT32_MAX ? phase : UINT32_MAX);
+        STATE_DIRTY(handoff_phase_ms);
+        state_flush();
+
+        uint64_t held = g_lease;
+        uint64_t next = ((uint64_t)(LEASE_EPOCH(held) + 1) << 32) | target;
+        g_handoff_target = 0;
+        if (!atomic_compare_exchange_strong_explicit(&g_state->lease, &held, next,
+                                                     memory_order_acq_rel,
+                                                     memory_order_relaxed)) {
+            lease_lost();
+            return;
+        }
+        STATE_DIRTY(lease);
+        state_wake();
+        g_lease = 0;
+        g_is_active = false;
+        return;
+    }
+
+    if (get_time_ms() - g_handoff_start >= HANDOFF_TIMEOUT_MS) {
+        uint32_t expected = target;
+        atomic_compare_exchange_strong(&g_state->takeover_request, &expected, 0);
+        STATE_DIRTY(takeover_request);
+        state_wake();
+        g_handoff_target = 0;
+    }
+}
+
+/* Standby side of a handoff: accept a request addressed to us, withdraw
+ * the accept if the request was aborted, and return true once the active
+ * has committed the lease to us. The accept goes in our own standby
+ * entry, so the ownership line keeps a single writer. */
+static bool handoff_answer(void) {
+    STATE_INVALIDATE(takeover_request);
+    uint32_t request = atomic_load_explicit(&g_state->takeover_request, memory_order_acquire);
+
+    if (g_standby >= 0) {
+        StandbySlot *slot = &g_state->standbys[g_standby];
+        uint32_t accept = request == g_owner_id ? g_owner_id : 0;
+        if (atomic_load_explicit(&slot->handoff_accept, memory_order_relaxed) != accept) {
+            atomic_store_explicit(&slot->handoff_accept, accept, memory_order_release);
+            STATE_DIRTY(standbys[g_standby]);
+            if (accept != 0) state_wake();
+            state_flush();
+        }
+    }
+    g_handoff_accepted = g_standby >= 0 && request == g_owner_id;
+
+    uint64_t lease = lease_read();
+    if (LEASE_OWNER(lease) != g_owner_id) {
+        return false;
+    }
+    g_handoff_accepted = false;
+    g_handoff_phase_ms = g_state->handoff_phase_ms;
+    lease_take(lease);
+    return true;
+}
+
+/* Check that the lease is still ours: a process that claimed a new epoch
+ * fences off every write we have not started yet */
+static bool lease_held(void) {
+    return g_lease != 0 && lease_read() == g_lease;
+}
+
+/* Step down after seeing another owner, and count the fencing event. The
+ * stats block now belongs to the other owner, so the count is published
+ * in our standby entry and folded into the stats once we own the game
+ * again. */
+static void lease_lost(void) {
+    g_lease = 0;
+    g_is_active = false;
+    g_fence_events++;
+}
+
+/* Fencing events of a session: those folded in by owners plus those still
+ * held in standby entries */
+static uint32_t fence_total(GameState *gs) {
+    uint32_t total = gs->fence_events;
+
+    for (int i = 0; i < MAX_STANDBYS; i++) {
+        if (atomic_load_explicit(&gs->standbys[i].owner_id, memory_order_acquire) != 0) {
+            total += gs->standbys[i].fence_events;
+        }
+    }
+    return total;
+}
+
+/* Per-tick split-brain check: the lease must still be ours, and no write
+ * section of our epoch or a later one may carry another owner's stamp.
+ * A stamp from an older epoch is a stale owner writing after it lost the
+ * lease; it fences itself on its own next check. Costs two cache line
+ * reads and no system call. Steps down and returns false on a conflict.
+ * Call only with no unflushed writes to the active control block. */
+static bool owner_check(void) {
+    STATE_INVALIDATE(owner_stamp);
+    uint64_t stamp = atomic_load_explicit(&g_state->owner_stamp, memory_order_acquire);
+
+    if ((stamp != g_lease && LEASE_EPOCH(stamp) >= LEASE_EPOCH(g_lease)) || !lease_held()) {
+        lease_lost();
+        return false;
+    }
+    return true;
+}
+
+/* Give the lease up on a clean shutdown, keeping its epoch, so the next
+ * process can take over without waiting for it to expire */
+static void lease_release(void) {
+    uint64_t held = g_lease;
+
+    if (held == 0) {
+        return;
+    }
+    g_lease = 0;
+    STATE_INVALIDATE(lease);
+    if (atomic_compare_exchange_strong_explicit(&g_state->lease, &held,
+                                                held & ~(uint64_t)UINT32_MAX,
+                                                memory_order_release,
+                                                memory_order_relaxed)) {
+        STATE_DIRTY(lease);
+        state_wake();
+    }
+}
+
+/* Node id for the standby registry: FNV-1a hash of the host name */
+static uint32_t hash_node_id(void) {
+    char host[256] = "";
+    uint32_t hash = 2166136261u;
+
+    gethostname(host, sizeof(host) - 1);
+    for (const char *c = host; *c; c++) {
+        hash = (hash ^ (uint8_t)*c) * 16777619u;
+    }
+    return hash;
+}
+
+/* Check whether a registry entry belongs to a standby that is still
+ * checking in. Entries of crashed standbys go stale and can be reused. */
+static bool standby_live(StandbySlot *slot, uint64_t now) {
+    if (atomic_load_explicit(&slot->owner_id, memory_order_acquire) == 0) {
+        return false;
+    }
+    uint64_t last_seen = atomic_load_explicit(&slot->last_seen, memory_order_acquire);
+    return now <= last_seen + (uint64_t)slot->check_ms * STANDBY_STALE_CHECKS + CLOCK_SLACK_MS;
+}
+
+/* Handoff and failover order: higher priority first, then lower owner id,
+ * so every process ranks the standbys the same way */
+static bool standby_before(const StandbySlot *a, const StandbySlot *b) {
+    if (a->priority != b->priority) {
+        return a->priority > b->priority;
+    }
+    return atomic_load_explicit(&a->owner_id, memory_order_relaxed) <
+           atomic_load_explicit(&b->owner_id, memory_order_relaxed);
+}
+
+/* Register as a standby in a free or stale entry. With a full registry
+ * the process still waits, ranked behind every registered standby. */
+static void standby_join(void) {
+    uint64_t now = get_realtime_ms();
+
+    STATE_INVALIDATE(standbys);
+    for (int i = 0; i < MAX_STANDBYS && g_standby < 0; i++) {
+        StandbySlot *slot = &g_state->standbys[i];
+        uint32_t id = atomic_load_explicit(&slot->owner_id, memory_order_acquire);
+
+        if ((id == 0 || !standby_live(slot, now)) &&
+            atomic_compare_exchange_strong(&slot->owner_id, &id, g_owner_id)) {
+            slot->pid = (uint32_t)getpid();
+            slot->node_id = g_node_id;
+            slot->priority = g_priority;
+            slot->check_ms = g_check_ms ? g_check_ms : owner_heartbeat_ms() / 2;
+            slot->fence_events = g_fence_events;
+            atomic_store_explicit(&slot->handoff_accept, 0, memory_order_relaxed);
+            atomic_store_explicit(&slot->last_seen, now, memory_order_release);
+            STATE_DIRTY(standbys[i]);
+            g_standby = i;
+        }
+    }
+    state_flush();
+}
+
+/* Remove our registry entry */
+static void standby_leave(void) {
+    if (g_standby < 0) {
+        return;
+    }
+
+    uint32_t id = g_owner_id;
+    atomic_compare_exchange_strong(&g_state->standbys[g_standby].owner_id, &id, 0);
+    STATE_DIRTY(standbys[g_standby]);
+    g_standby = -1;
+}
+
+/* Refresh our registry entry and our place in the failover order */
+static void standby_check(void) {
+    uint64_t now = get_realtime_ms();
+
+    STATE_INVALIDATE(standbys);
+
+    /* Re-register if our entry was taken over as stale */
+    if (g_standby >= 0 &&
+        atomic_load_explicit(&g_state->standbys[g_standby].owner_id,
+                             memory_order_relaxed) != g_owner_id) {
+        g_standby = -1;
+    }
+    if (g_standby < 0) {
+        standby_join();
+    } else {
+        g_state->standbys[g_standby].fence_events = g_fence_events;
+        atomic_store_explicit(&g_state->standbys[g_standby].last_seen, now,
+                              memory_order_release);
+        STATE_DIRTY(standbys[g_standby]);
+        state_flush();
+    }
+
+    g_standby_rank = 0;
+    g_standby_count = g_standby < 0 ? 1 : 0;
+    for (int i = 0; i < MAX_STANDBYS; i++) {
+        StandbySlot *slot = &g_state->standbys[i];
+        if (!standby_live(slot, now)) {
+            continue;
+        }
+        g_standby_count++;
+        if (g_standby < 0 || (i != g_standby && standby_before(slot, &g_state->standbys[g_standby]))) {
+            g_standby_rank++;
+        }
+    }
+}
+
+/* Owner id of the first live standby in handoff order, 0 if none */
+static uint32_t standby_best(void) {
+    uint64_t now = get_realtime_ms();
+    StandbySlot *best = NULL;
+
+    STATE_INVALIDATE(standbys);
+    for (int i = 0; i < MAX_STANDBYS; i++) {
+        StandbySlot *slot = &g_state->standbys[i];
+        if (standby_live(slot, now) && (best == NULL || standby_before(slot, best))) {
+            best = slot;
+        }
+    }
+    return best ? atomic_load_explicit(&best->owner_id, memory_order_relaxed) : 0;
+}
+
+/* Decide the startup role, returning true with the lease claimed if this
+ * process becomes active. Only a lease with no usable timestamp needs
+ * the timed probe; otherwise the decision is immediate:
+ *   released or never owned  -> claim it
+ *   not renewed for longer than the lease plus clock slack -> claim it
+ *   renewed recently -> wait, the failure detector takes it from there */
+static bool claim_at_startup(void) {
+    STATE_INVALIDATE(feature_flags);
+    uint32_t features = g_state->feature_flags;
+
+    /* An owner of an older build may drive the game without a lease or
+     * without publishing its heartbeat time; only the probe sees it */
+    uint64_t lease = lease_read();
+    if (LEASE_OWNER(lease) == 0 && (features & FEATURE_LEASE)) {
+        return lease_claim(lease);
+    }
+
+    STATE_INVALIDATE(heartbeat_time);
+    uint64_t renewed = (features & FEATURE_HEARTBEAT_TIME) ? g_state->heartbeat_time : 0;
+    if (renewed != 0 && g_probe_ms == 0) {
+        if (get_realtime_ms() > renewed + lease_duration_ms() + CLOCK_SLACK_MS) {
+            return lease_claim(lease);
+        }
+        return false;
+    }
+
+    uint64_t initial_heartbeat = heartbeat_read();
+
+    out_str("Checking for active process...\n");
+    out_flush();
+
+    /* Wait out the owner's lease plus one heartbeat */
+    usleep((g_probe_ms ? g_probe_ms : lease_duration_ms() + owner_heartbeat_ms()) * 1000);
+
+    return heartbeat_read() == initial_heartbeat && lease_claim(lease);
+}
+
+/* Heartbeat period published by the current owner */
+static uint32_t owner_heartbeat_ms(void) {
+    STATE_INVALIDATE(heartbeat_ms);
+    return g_state->heartbeat_ms ? g_state->heartbeat_ms : HEARTBEAT_INTERVAL_MS;
+}
+
+/* How long the current owner's lease lasts without a heartbeat */
+static uint64_t lease_duration_ms(void) {
+    STATE_INVALIDATE(lease_ticks);
+    uint32_t ticks = g_state->lease_ticks ? g_state->lease_ticks : LEASE_TICKS;
+    return (uint64_t)ticks * owner_heartbeat_ms();
+}
+
+/* Start watching the owner, assuming its heartbeats arrive on time with a
+ * deviation of half a period until real samples come in */
+static void detector_reset(FailureDetector *fd) {
+    uint64_t period = owner_heartbeat_ms();
+
+    fd->heartbeat = heartbeat_read();
+    fd->lease = lease_read();
+    fd->last_change = get_time_ms();
+    fd->mean8 = period * 8;
+    fd->dev8 = period * 4;
+}
+
+/* Sample the heartbeat and lease. Returns true if either changed. Each
+ * change folds the time since the previous one, per heartbeat tick, into
+ * the inter-arrival estimate. */
+static bool detector_observe(FailureDetector *fd) {
+    uint64_t heartbeat = heartbeat_read();
+    uint64_t lease = lease_read();
+    uint64_t now = get_time_ms();
+
+    if (heartbeat == fd->heartbeat && lease == fd->lease) {
+        return false;
+    }
+
+    /* A new owner starts a new heartbeat history */
+    if (lease != fd->lease) {
+        detector_reset(fd);
+        return true;
+    }
+
+    uint64_t ticks = heartbeat - fd->heartbeat;
+    uint64_t sample = (now - fd->last_change) / (ticks ? ticks : 1);
+    uint64_t mean = fd->mean8 / 8;
+    uint64_t error = sample > mean ? sample - mean : mean - sample;
+
+    fd->mean8 = fd->mean8 - fd->mean8 / 8 + sample;
+    fd->dev8 = fd->dev8 - fd->dev8 / 4 + error * 2;
+    fd->heartbeat = heartbeat;
+    fd->last_change = now;
+    return true;
+}
+
+/* Silence after which the owner is presumed dead: the expected gap plus a
+ * jitter margin, and never before the owner's lease has run out */
+static uint64_t detector_timeout_ms(const FailureDetector *fd) {
+    uint64_t timeout = fd->mean8 / 8 + DETECTOR_DEV_FACTOR * fd->dev8 / 8;
+    uint64_t lease = lease_duration_ms();
+    return timeout > lease ? timeout : lease;
+}
+
+/* Publish a liveness tick, which renews our lease. The release store is
+ * the point where everything the active wrote before it (the last move,
+ * direction changes) becomes visible to a waiter that acquires the new
+ * value. */
+static void heartbeat_publish(void) {
+    if (!lease_held()) {
+        lease_lost();
+        return;
+    }
+
+    g_state->heartbeat_time = get_realtime_ms();
+    STATE_DIRTY(heartbeat_time);
+
+    uint64_t heartbeat = atomic_load_explicit(&g_state->heartbeat, memory_order_relaxed);
+    atomic_store_explicit(&g_state->heartbeat, heartbeat + 1, memory_order_release);
+    STATE_DIRTY(heartbeat);
+}
+
+/* Hold the takeover message for g_takeover_delay_ms after a claim. The
+ * new lease is renewed through the pause, which may be longer than the
+ * lease itself with a short --heartbeat-ms. */
+static void takeover_pause(void) {
+    uint64_t end = get_time_ms() + g_takeover_delay_ms;
+
+    while (g_is_active) {
+        heartbeat_publish();
+        state_flush();
+
+        uint64_t now = get_time_ms();
+        if (now >= end) {
+            break;
+        }
+        uint64_t sleep_ms = end - now < g_heartbeat_ms ? end - now : g_heartbeat_ms;
+        usleep((useconds_t)(sleep_ms * 1000));
+    }
+}
+
+/* Read the active's liveness tick, acquiring the writes published with it */
+static uint64_t heartbeat_read(void) {
+    STATE_INVALIDATE(heartbeat);
+    return atomic_load_explicit(&g_state->heartbeat, memory_order_acquire);
+}
+
+/* Grow a file-like object so the region fits (never shrink it) */
+static int ensure_size(int fd, off_t required_size) {
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        perror("fstat");
+        return -1;
+    }
+    if (st.st_size < required_size && ftruncate(fd, required_size) == -1) {
+        perror("ftruncate");
+        return -1;
+    }
+    return 0;
+}
+
+/* Physical memory window: fixed size, mapped cached (no O_SYNC, which
+ * would make every access uncached) and kept consistent with CPU cache
+ * maintenance on the dirty lines */
+static int devmem_open(const char *path, off_t offset, size_t *map_len) {
+    (void)offset;
+    (void)map_len;
+    return open(path, O_RDWR);
+}
+
+/* Regular file: created and sized on demand, flushed with msync */
+static int file_open(const char *path, off_t offset, size_t *map_len) {
+    int fd = open(path, O_RDWR | O_CREAT, 0666);
+    if (fd != -1 && ensure_size(fd, offset + (off_t)*map_len) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* POSIX shared memory object: coherent host memory, nothing to flush */
+static int shm_backend_open(const char *path, off_t offset, size_t *map_len) {
+    int fd = shm_open(path, O_RDWR | O_CREAT, 0666);
+    if (fd != -1 && ensure_size(fd, offset + (off_t)*map_len) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Anonymous memfd: private to this process and its children (or others
+ * opening /proc/<pid>/fd/<n> with the file backend), for tests and benchmarks.
+ * With --hugepages it is allocated from the hugetlb pool. */
+static int memfd_backend_open(const char *path, off_t offset, size_t *map_len) {
+    int fd = memfd_create(path, MFD_CLOEXEC | (g_hugepages ? MFD_HUGETLB : 0));
+    if (fd == -1) {
+        return -1;
+    }
+
+    if (g_hugepages) {
+        struct stat st;
+        size_t huge_page = (fstat(fd, &st) == 0) ? (size_t)st.st_blksize : 0;
+        if (huge_page == 0 || offset % (off_t)huge_page != 0) {
+            fprintf(stderr, "Offset must be a multiple of the huge page size (0x%zx)\n", huge_page);
+            close(fd);
+            errno = EINVAL;
+            return -1;
+        }
+        *map_len = (*map_len + huge_page - 1) / huge_page * huge_page;
+    }
+
+    if (ensure_size(fd, offset + (off_t)*map_len) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* File on a hugetlbfs mount: offset and length must be whole huge pages */
+static int hugetlbfs_open(const char *path, off_t offset, size_t *map_len) {
+    int fd = open(path, O_RDWR | O_CREAT, 0666);
+    if (fd == -1) {
+        return -1;
+    }
+
+    struct statfs sfs;
+    if (fstatfs(fd, &sfs) == -1 || (unsigned long)sfs.f_type != HUGETLBFS_MAGIC) {
+        fprintf(stderr, "%s is not on a hugetlbfs mount\n", path);
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t huge_page = (size_t)sfs.f_bsize;
+    if (offset % (off_t)huge_page != 0) {
+        fprintf(stderr, "Offset must be a multiple of the huge page size (0x%zx)\n", huge_page);
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    *map_len = (*map_len + huge_page - 1) / huge_page * huge_page;
+    if (ensure_size(fd, offset + (off_t)*map_len) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static const MemBackend g_mem_backends[] = {
+    { "devmem",    MEM_FILE,                     MEM_OFFSET, NULL,    devmem_open,        HUGE_NONE },
+    { "file",      "/tmp/snake_game.state",      0,          "msync", file_open,          HUGE_NONE },
+    { "shm",       "/snake_game",                0,          "none",  shm_backend_open,   HUGE_ADVISE },
+    { "memfd",     "snake_game",                 0,          "none",  memfd_backend_open, HUGE_OPEN },
+    { "hugetlbfs", "/dev/hugepages/snake_game",  0,          "none",  hugetlbfs_open,     HUGE_OPEN },
+};
+
+/* Resolve the memory backend and fill in its default path and offset.
+ * Without -b, a character device is treated as a /dev/mem style window and
+ * anything else as a regular file. */
+static int setup_backend(void) {
+    const char *name = g_mem_backend_name;
+
+    if (name == NULL) {
+        struct stat st;
+        const char *path = g_mem_file != NULL ? g_mem_file : MEM_FILE;
+        name = (stat(path, &st) == 0 && S_ISCHR(st.st_mode)) ? "devmem" : "file";
+    }
+
+    for (size_t i = 0; i < sizeof(g_mem_backends) / sizeof(g_mem_backends[0]); i++) {
+        if (strcmp(name, g_mem_backends[i].name) == 0) {
+            g_mem_backend = &g_mem_backends[i];
+            break;
+        }
+    }
+    if (g_mem_backend == NULL) {
+        fprintf(stderr, "Unknown memory backend: %s\n", name);
+        return -1;
+    }
+
+    if (g_hugepages && g_mem_backend->hugepages == HUGE_NONE) {
+        fprintf(stderr, "%s backend cannot provide huge pages, use shm, memfd or hugetlbfs\n",
+                g_mem_backend->name);
+        return -1;
+    }
+
+    if (g_mem_file == NULL) g_mem_file = g_mem_backend->default_path;
+    if (g_mem_offset < 0) g_mem_offset = g_mem_backend->default_offset;
+    return 0;
+}
+
+/* Open the backend and map len bytes of the region at the configured offset */
+static int map_region(size_t len) {
+    g_map_len = len;
+    g_mem_fd = g_mem_backend->open(g_mem_file, g_mem_offset, &g_map_len);
+    if (g_mem_fd == -1) {
+        fprintf(stderr, "%s backend: cannot open %s: %s\n",
+                g_mem_backend->name, g_mem_file, strerror(errno));
+        return -1;
+    }
+
+    g_region = mmap(NULL, g_map_len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | (g_prefault ? MAP_POPULATE : 0), g_mem_fd, g_mem_offset);
+    if (g_region == MAP_FAILED) {
+        perror("mmap");
+        close(g_mem_fd);
+        g_mem_fd = -1;
+        g_region = NULL;
+        return -1;
+    }
+
+    /* shmem has no hugetlb pool but can use transparent huge pages, if the
+     * kernel has them and /sys/kernel/mm/transparent_hugepage/shmem_enabled
+     * allows advice */
+    if (g_hugepages && g_mem_backend->hugepages == HUGE_ADVISE &&
+        madvise(g_region, g_map_len, MADV_HUGEPAGE) == -1) {
+        perror("madvise(MADV_HUGEPAGE)");
+        return -1;
+    }
+
+    /* Pay for page faults now rather than during the liveness probe and the
+     * first ticks, and keep the region resident */
+    if (g_prefault && mlock(g_region, g_map_len) == -1) {
+        perror("mlock");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Unmap the region and close the backend */
+static void unmap_region(void) {
+    if (g_region != NULL) {
+        munmap(g_region, g_map_len);
+        g_region = NULL;
+        g_dir = NULL;
+    }
+
+    if (g_mem_fd != -1) {
+        close(g_mem_fd);
+        g_mem_fd = -1;
+    }
+}
+
+/* Setup mmap shared memory */
+static int setup_mmap(void) {
+    if (g_session_id < 0) {
+        if (map_region(STATE_MAP_SIZE) != 0) {
+            return -1;
+        }
+        g_state = g_region;
+        return attach_state(STATE_MAP_SIZE);
+    }
+
+    if (map_sessions() != 0 || session_attach() != 0) {
+        return -1;
+    }
+    return attach_state(g_dir->slot_size);
+}
+
+/* Write back a range of the region outside the dirty-tracked GameState */
+static void region_flush(const void *addr, size_t len) {
+    g_flush->clean(addr, len);
+    g_flush->drain();
+}
+
+/* Size of a multi-session region with count slots */
+static size_t session_region_size(uint32_t count, uint32_t slot_size, uint64_t *slots_offset) {
+    size_t dir_size = offsetof(SessionDirectory, slots) + count * sizeof(SessionSlot);
+    *slots_offset = (dir_size + SESSION_ALIGN - 1) / SESSION_ALIGN * SESSION_ALIGN;
+    return *slots_offset + (size_t)count * slot_size;
+}
+
+/* Initialize the session directory, or wait for the process that is */
+static int format_directory(void) {
+    uint32_t magic = atomic_load_explicit(&g_dir->magic, memory_order_acquire);
+
+    if (magic != SESSION_DIR_FORMATTING && magic != SESSION_DIR_MAGIC &&
+        atomic_compare_exchange_strong(&g_dir->magic, &magic, SESSION_DIR_FORMATTING)) {
+        uint64_t slots_offset;
+        session_region_size(g_max_sessions, SESSION_SLOT_SIZE, &slots_offset);
+
+        g_dir->version = SESSION_DIR_VERSION;
+        g_dir->slot_count = g_max_sessions;
+        g_dir->slot_size = SESSION_SLOT_SIZE;
+        g_dir->slots_offset = slots_offset;
+        memset(g_dir->slots, 0, g_max_sessions * sizeof(SessionSlot));
+        region_flush(g_dir, slots_offset);
+
+        atomic_store_explicit(&g_dir->magic, SESSION_DIR_MAGIC, memory_order_release);
+        region_flush(g_dir, sizeof(*g_dir));
+        return 0;
+    }
+
+    for (int i = 0; i < 1000; i++) {
+        state_invalidate(g_dir, sizeof(*g_dir));
+        if (atomic_load_explicit(&g_dir->magic, memory_order_acquire) == SESSION_DIR_MAGIC) {
+            return 0;
+        }
+        usleep(1000);
+    }
+    fprintf(stderr, "Session directory initialization did not complete\n");
+    return -1;
+}
+
+/* Map a multi-session region, creating its directory if it has none. The
+ * header is read through a small mapping first to learn the full size. */
+static int map_sessions(void) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (map_region(sizeof(SessionDirectory)) != 0) {
+            return -1;
+        }
+        g_dir = g_region;
+        state_invalidate(g_dir, sizeof(*g_dir));
+
+        uint32_t magic = atomic_load_explicit(&g_dir->magic, memory_order_acquire);
+        bool formatted = (magic == SESSION_DIR_MAGIC);
+        uint32_t count = formatted ? g_dir->slot_count : g_max_sessions;
+        uint32_t slot_size = formatted ? g_dir->slot_size : SESSION_SLOT_SIZE;
+
+        /* Never format over a single-session game, and only create a
+         * directory for a session that is being played */
+        const uint32_t *words = g_region;
+        bool single = (words[0] == REGION_MAGIC || words[2] == LEGACY_MAGIC_NUMBER);
+        unmap_region();
+
+        if (!formatted && single) {
+            fprintf(stderr, "Shared region holds a single-session game, not a session directory\n");
+            return -1;
+        }
+        if (!formatted && magic != SESSION_DIR_FORMATTING &&
+            g_session_cmd != SESSION_CMD_NONE) {
+            fprintf(stderr, "Shared region has no session directory\n");
+            return -1;
+        }
+
+        if (count == 0 || count > MAX_SESSIONS) {
+            fprintf(stderr, "Session directory has an invalid slot count %u\n", count);
+            return -1;
+        }
+
+        /* Directories of earlier builds have larger slots, which still
+         * hold the current layout */
+        if (slot_size < SESSION_SLOT_SIZE || slot_size % SESSION_ALIGN != 0) {
+            fprintf(stderr, "Session directory slot size %u, expected a multiple of %u "
+                    "of at least %zu\n", slot_size, (unsigned)SESSION_ALIGN, (size_t)SESSION_SLOT_SIZE);
+            return -1;
+        }
+
+        uint64_t slots_offset;
+        if (map_region(session_region_size(count, slot_size, &slots_offset)) != 0) {
+            return -1;
+        }
+        g_dir = g_region;
+
+        if (!formatted && format_directory() != 0) {
+            return -1;
+        }
+
+        state_invalidate(g_dir, offsetof(SessionDirectory, slots));
+        if (g_dir->version != SESSION_DIR_VERSION) {
+            fprintf(stderr, "Session directory version %u, expected %u\n",
+                    g_dir->version, SESSION_DIR_VERSION);
+            return -1;
+        }
+
+        /* Another process may have created the directory with more slots */
+        if (g_dir->slot_size == slot_size &&
+            session_region_size(g_dir->slot_count, slot_size, &slots_offset) <= g_map_len) {
+            state_invalidate(g_dir->slots, g_dir->slot_count * sizeof(SessionSlot));
+            return 0;
+        }
+        unmap_region();
+    }
+
+    fprintf(stderr, "Session directory changed while attaching\n");
+    return -1;
+}
+
+/* GameState of a session slot */
+static GameState *session_state(uint32_t slot) {
+    return (GameState *)((char *)g_region + g_dir->slots_offset +
+                         (size_t)slot * g_dir->slot_size);
+}
+
+/* Wait for a slot that is being allocated to settle, return its state */
+static uint32_t slot_settled_state(SessionSlot *slot) {
+    uint32_t state = SLOT_CLAIMING;
+
+    for (int i = 0; i < 1000; i++) {
+        state_invalidate(slot, sizeof(*slot));
+        state = atomic_load_explicit(&slot->state, memory_order_acquire);
+        if (state != SLOT_CLAIMING) break;
+        usleep(1000);
+    }
+    return state;
+}
+
+/* Find the slot holding session id, or -1 */
+static int session_find(uint32_t id) {
+    for (uint32_t i = 0; i < g_dir->slot_count; i++) {
+        SessionSlot *slot = &g_dir->slots[i];
+        if (slot_settled_state(slot) == SLOT_USED && slot->session_id == id) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+/* Point g_state at the slot of g_session_id, allocating a slot for a new
+ * session. Allocation walks from the id's home slot, so two processes
+ * creating the same session race for the same free slot and the loser
+ * finds the winner's entry instead of creating a duplicate. */
+static int session_attach(void) {
+    uint32_t id = (uint32_t)g_session_id;
+    uint32_t count = g_dir->slot_count;
+    int found = session_find(id);
+
+    for (uint32_t i = 0; found < 0 && i < count; i++) {
+        uint32_t index = (id + i) % count;
+        SessionSlot *slot = &g_dir->slots[index];
+        uint32_t expected = SLOT_FREE;
+
+        if (atomic_compare_exchange_strong(&slot->state, &expected, SLOT_CLAIMING)) {
+            /* A fresh GameState: attach_state() formats it */
+            memset(session_state(index), 0, g_dir->slot_size);
+            region_flush(session_state(index), g_dir->slot_size);
+
+            slot->session_id = id;
+            slot->created = (uint64_t)time(NULL);
+            atomic_store_explicit(&slot->state, SLOT_USED, memory_order_release);
+            region_flush(slot, sizeof(*slot));
+            found = (int)index;
+        } else if (slot_settled_state(slot) == SLOT_USED && slot->session_id == id) {
+            found = (int)index;
+        }
+    }
+
+    if (found < 0) {
+        fprintf(stderr, "No free session slots (%u in use)\n", count);
+        return -1;
+    }
+
+    g_state = session_state((uint32_t)found);
+    return 0;
+}
+
+/* Check whether a process still plays or watches the session at g_state */
+static bool session_running(void) {
+    uint64_t now = get_realtime_ms();
+
+    STATE_INVALIDATE(standbys);
+    for (int i = 0; i < MAX_STANDBYS; i++) {
+        if (standby_live(&g_state->standbys[i], now)) {
+            return true;
+        }
+    }
+    return owner_running();
+}
+
+/* Check whether the session at g_state has a live owner. A held lease is
+ * live until the owner's published heartbeat time is older than its
+ * lease; without one the heartbeat is watched for a lease plus one
+ * heartbeat, as in claim_at_startup(). */
+static bool owner_running(void) {
+    uint64_t now = get_realtime_ms();
+
+    STATE_INVALIDATE(feature_flags);
+    uint32_t features = g_state->feature_flags;
+    if (LEASE_OWNER(lease_read()) == 0 && (features & FEATURE_LEASE)) {
+        return false;
+    }
+
+    STATE_INVALIDATE(heartbeat_time);
+    uint64_t renewed = (features & FEATURE_HEARTBEAT_TIME) ? g_state->heartbeat_time : 0;
+    if (renewed != 0) {
+        return now <= renewed + lease_duration_ms() + CLOCK_SLACK_MS;
+    }
+
+    uint64_t heartbeat = heartbeat_read();
+    usleep((lease_duration_ms() + owner_heartbeat_ms()) * 1000);
+    return heartbeat_read() != heartbeat;
+}
+
+/* List the sessions of a multi-session region, or free one */
+static int run_session_command(void) {
+    if (map_sessions() != 0) {
+        return 1;
+    }
+
+    if (g_session_cmd == SESSION_CMD_LIST) {
+        printf("%-6s %-10s %-9s %-8s %-8s %-7s %s\n", "SLOT", "SESSION", "STATE", "SCORE",
+               "HIGH", "FENCED", "HEARTBEAT");
+        for (uint32_t i = 0; i < g_dir->slot_count; i++) {
+            if (slot_settled_state(&g_dir->slots[i]) != SLOT_USED) {
+                continue;
+            }
+            GameState *gs = session_state(i);
+            state_invalidate(gs, offsetof(GameState, occupancy));
+            state_invalidate(gs->standbys, sizeof(gs->standbys));
+
+            const char *state = "new";
+            if (gs->magic_number == REGION_MAGIC && gs->snake_length > 0) {
+                state = gs->game_state == STATE_PAUSED ? "paused" :
+                        gs->game_state == STATE_GAMEOVER ? "gameover" :
+                        gs->game_state == STATE_WON ? "won" : "running";
+            }
+            printf("%-6u %-10u %-9s %-8u %-8u %-7u %llu\n", i, g_dir->slots[i].session_id,
+                   state, gs->score, gs->high_score,
+                   fence_total(gs),
+                   (unsigned long long)atomic_load_explicit(&gs->heartbeat,
+                                                            memory_order_acquire));
+        }
+        return 0;
+    }
+
+    /* SESSION_CMD_FREE: refuse while a process still plays or watches it */
+    int index = session_find((uint32_t)g_session_id);
+    if (index < 0) {
+        fprintf(stderr, "Session %lld not found\n", g_session_id);
+        return 1;
+    }
+
+    g_state = session_state((uint32_t)index);
+    state_invalidate(g_state, offsetof(GameState, occupancy));
+    if (g_state->magic_number == REGION_MAGIC && session_running()) {
+        fprintf(stderr, "Session %lld is still running\n", g_session_id);
+        return 1;
+    }
+
+    atomic_store_explicit(&g_dir->slots[index].state, SLOT_FREE, memory_order_release);
+    region_flush(&g_dir->slots[index], sizeof(SessionSlot));
+    printf("Freed session %lld (slot %d)\n", g_session_id, index);
+    return 0;
+}
+
+/* Check the region header and bring the region to the current layout.
+ * Fails without touching memory if the region holds a layout this build
+ * cannot safely use. avail is the space mapped at g_state; layouts larger
+ * than the current one are only migrated where they fit. */
+static int attach_state(size_t avail) {
+    const LegacyGameState *legacy = (const LegacyGameState *)g_state;
+
+    state_invalidate(g_state, avail < STATE_MAP_SIZE ? avail : STATE_MAP_SIZE);
+
+    if (g_state->magic_number == SESSION_DIR_MAGIC ||
+        g_state->magic_number == SESSION_DIR_FORMATTING) {
+        fprintf(stderr, "Shared region holds a session directory, select a session with -s\n");
+        return -1;
+    }
+
+    if (g_state->magic_number != REGION_MAGIC) {
+        if (legacy->magic_number == LEGACY_MAGIC_NUMBER && avail >= STATE_MAP_SIZE) {
+            return migrate_legacy_state();
+        }
+        /* Never initialized, or not ours: start fresh */
+        format_state();
+        return 0;
+    }
+
+    if (g_state->layout_version > LAYOUT_VERSION) {
+        fprintf(stderr, "Shared region has layout version %u, this build supports up to %u\n",
+                g_state->layout_version, LAYOUT_VERSION);
+        return -1;
+    }
+
+    if (g_state->layout_version == 2 && g_state->struct_size == sizeof(GameStateV2) &&
+        g_state->max_snake_len == OLD_MAX_SNAKE_LEN && avail >= STATE_MAP_SIZE) {
+        return migrate_v2_state();
+    }
+
+    if (((g_state->layout_version == 3 && g_state->struct_size == LAYOUT_V3_SIZE) ||
+         (g_state->layout_version == 4 && g_state->struct_size == LAYOUT_V4_SIZE)) &&
+        g_state->max_snake_len == OLD_MAX_SNAKE_LEN) {
+        return migrate_v4_state();
+    }
+
+    if (g_state->struct_size != sizeof(GameState) ||
+        g_state->board_width != BOARD_WIDTH ||
+        g_state->board_height != BOARD_HEIGHT ||
+        g_state->max_snake_len != MAX_SNAKE_LEN) {
+        fprintf(stderr, "Shared region layout mismatch: size %u board %ux%u max length %u, "
+                "expected size %zu board %ux%u max length %u\n",
+                g_state->struct_size, g_state->board_width, g_state->board_height,
+                g_state->max_snake_len, sizeof(GameState), BOARD_WIDTH, BOARD_HEIGHT,
+                MAX_SNAKE_LEN);
+        return -1;
+    }
+
+    /* The flags stay as the current owner wrote them until we own the game */
+    return 0;
+}
+
+/* Fill in the header of the current layout */
+static void write_header(void) {
+    g_state->layout_version = LAYOUT_VERSION;
+    g_state->struct_size = sizeof(GameState);
+    g_state->feature_flags = FEATURES_KNOWN;
+    g_state->board_width = BOARD_WIDTH;
+    g_state->board_height = BOARD_HEIGHT;
+    g_state->max_snake_len = MAX_SNAKE_LEN;
+    g_state->magic_number = REGION_MAGIC;
+}
+
+/* Initialize an empty region with the current layout */
+static void format_state(void) {
+    memset(g_state, 0, sizeof(GameState));
+    write_header();
+    state_mark_dirty(g_state, sizeof(GameState));
+    state_flush();
+}
+
+/* Check whether a process of an older build still heartbeats on the
+ * region; it would keep writing the old layout over a migrated one */
+static bool older_build_running(const void *heartbeat) {
+    const volatile uint64_t *hb = heartbeat;
+
+    state_invalidate(heartbeat, sizeof(uint64_t));
+    uint64_t before = *hb;
+    usleep(HEARTBEAT_INTERVAL_MS * 3 * 1000);
+    state_invalidate(heartbeat, sizeof(uint64_t));
+    if (*hb != before) {
+        fprintf(stderr, "Shared region is in use by an older build, stop it before upgrading\n");
+        return true;
     }
-    g_terminal_raw = true;
+    return false;
+}
 
-    struct termios raw = g_orig_termios;
-    raw.c_lflag &= ~(ECHO | ICANON | ISIG);
-    raw.c_iflag &= ~(IXON | ICRNL);
-    raw.c_cc[VMIN] = 0;
-    raw.c_cc[VTIME] = 0;
+/* Encode a body given as cells from tail to head. Fails if two
+ * consecutive segments are not neighbours. */
+static bool body_load(const Point *segs, uint32_t count) {
+    g_state->snake_length = 0;
+    g_state->body_tail = 0;
+    if (count == 0 || count > MAX_SNAKE_LEN) {
+        return false;
+    }
 
-    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1) {
-        perror("tcsetattr");
-        exit(1);
+    for (uint32_t i = 0; i < count; i++) {
+        if (segs[i].x < 0 || segs[i].x >= BOARD_WIDTH ||
+            segs[i].y < 0 || segs[i].y >= BOARD_HEIGHT) {
+            return false;
+        }
+        if (i > 0) {
+            uint32_t dir;
+            for (dir = 0; dir < 4; dir++) {
+                Point next = point_step(segs[i - 1], dir);
+                if (next.x == segs[i].x && next.y == segs[i].y) break;
+            }
+            if (dir == 4) {
+                return false;
+            }
+            body_set_step(i - 1, dir);
+        }
     }
-}
 
-/* Disable raw terminal mode */
-static void disable_raw_mode(void) {
-    if (g_terminal_raw) {
-        tcsetattr(STDIN_FILENO, TCSAFLUSH, &g_orig_termios);
-        g_terminal_raw = false;
+    memset(g_state->occupancy, 0, sizeof(g_state->occupancy));
+    for (uint32_t i = 0; i < count; i++) {
+        cell_set(segs[i].x, segs[i].y);
     }
+    g_state->tail_x = (int16_t)segs[0].x;
+    g_state->tail_y = (int16_t)segs[0].y;
+    g_state->head_x = (int16_t)segs[count - 1].x;
+    g_state->head_y = (int16_t)segs[count - 1].y;
+    g_state->snake_length = count;
+    return true;
 }
 
-/* Cleanup function */
-static void cleanup(void) {
-    show_cursor();
-    disable_raw_mode();
-    clear_screen();
+/* Convert a version 1 region in place, keeping the game running on it */
+static int migrate_legacy_state(void) {
+    static LegacyGameState old;
+    static Point segs[OLD_MAX_SNAKE_LEN];
+    const LegacyGameState *legacy = (const LegacyGameState *)g_state;
 
-    if (g_state != NULL) {
-        msync(g_state, sizeof(GameState), MS_SYNC);
-        munmap(g_state, sizeof(GameState));
-        g_state = NULL;
+    if (older_build_running(&legacy->heartbeat)) {
+        return -1;
     }
 
-    if (g_mem_fd != -1) {
-        close(g_mem_fd);
-        g_mem_fd = -1;
+    memcpy(&old, legacy, sizeof(old));
+    if (old.snake_length > OLD_MAX_SNAKE_LEN) {
+        old.snake_length = 0;  /* corrupt, let the next start begin a new game */
+    }
+
+    memset(g_state, 0, STATE_MAP_SIZE);
+    atomic_store_explicit(&g_state->heartbeat, old.heartbeat, memory_order_relaxed);
+    g_state->game_state = old.game_state;
+    g_state->direction = old.direction;
+    g_state->food_x = old.food_x;
+    g_state->food_y = old.food_y;
+    g_state->score = old.score;
+    g_state->high_score = old.high_score;
+
+    /* The old body runs head -> tail from index 0 */
+    for (uint32_t i = 0; i < old.snake_length; i++) {
+        segs[i] = old.snake[old.snake_length - 1 - i];
     }
+    body_load(segs, old.snake_length);
+
+    /* Publish the header last so a reader never sees it over old data */
+    write_header();
+    state_mark_dirty(g_state, sizeof(GameState));
+    state_flush();
+    return 0;
 }
 
-/* Setup mmap shared memory */
-static int setup_mmap(void) {
-    g_mem_fd = open(g_mem_file, O_RDWR | O_CREAT, 0666);
-    if (g_mem_fd == -1) {
-        perror("open");
+/* Convert a version 2 region in place: the Point ring becomes head and
+ * tail cells plus packed steps */
+static int migrate_v2_state(void) {
+    static GameStateV2 old;
+    static Point segs[OLD_MAX_SNAKE_LEN];
+    GameStateV2 *v2 = (GameStateV2 *)g_state;
+
+    if (older_build_running(&v2->heartbeat)) {
         return -1;
     }
 
-    /* Ensure file is correct size (offset + GameState size) */
-    struct stat st;
-    if (fstat(g_mem_fd, &st) == -1) {
-        perror("fstat");
-        close(g_mem_fd);
-        return -1;
+    memcpy(&old, v2, sizeof(old));
+    if (old.snake_length > OLD_MAX_SNAKE_LEN) {
+        old.snake_length = 0;
     }
 
-/*    off_t required_size = g_mem_offset + (off_t)sizeof(GameState);
-    if (st.st_size < required_size) {
-        if (ftruncate(g_mem_fd, required_size) == -1) {
-            perror("ftruncate");
-            close(g_mem_fd);
-            return -1;
-        }
-    }*/
+    memset(g_state, 0, STATE_MAP_SIZE);
+    atomic_store_explicit(&g_state->heartbeat,
+                          atomic_load_explicit(&old.heartbeat, memory_order_relaxed),
+                          memory_order_relaxed);
+    g_state->game_state = old.game_state;
+    g_state->direction = old.direction;
+    g_state->food_x = old.food_x;
+    g_state->food_y = old.food_y;
+    atomic_store_explicit(&g_state->seq,
+                          atomic_load_explicit(&old.seq, memory_order_relaxed) & ~1u,
+                          memory_order_relaxed);
+    g_state->score = old.score;
+    g_state->high_score = old.high_score;
+
+    for (uint32_t i = 0; i < old.snake_length; i++) {
+        segs[i] = old.snake[(old.snake_tail + i) % OLD_MAX_SNAKE_LEN];
+    }
+    body_load(segs, old.snake_length);
 
-    g_state = mmap(NULL, sizeof(GameState), PROT_READ | PROT_WRITE,
-                   MAP_SHARED, g_mem_fd, g_mem_offset);
-    if (g_state == MAP_FAILED) {
-        perror("mmap");
-        close(g_mem_fd);
-        g_state = NULL;
+    write_header();
+    g_state->feature_flags = old.feature_flags | FEATURES_KNOWN;
+    state_mark_dirty(g_state, sizeof(GameState));
+    state_flush();
+    return 0;
+}
+
+/* Convert a version 3 or 4 region in place: the body ring grows to the
+ * whole board, which moves the standby registry (version 3 had none, and
+ * a pending takeover request there meant any waiter and is dropped) */
+static int migrate_v4_state(void) {
+    static uint8_t old_body[OLD_BODY_BYTES];
+    static StandbySlot old_standbys[MAX_STANDBYS];
+    static Point segs[OLD_MAX_SNAKE_LEN];
+    bool v3 = (g_state->layout_version == 3);
+
+    /* These builds publish their lease and heartbeat period at the same
+     * offsets, so the owner is judged as for any session */
+    if (owner_running()) {
+        fprintf(stderr, "Shared region is in use by an older build, stop it before upgrading\n");
         return -1;
     }
 
-    if (g_state->magic_number != MAGIC_NUMBER) {
-        memset(g_state, 0, sizeof(GameState));
-        g_state->magic_number = MAGIC_NUMBER;
+    /* Waiters of the older build keep rewriting their registry entries,
+     * which now overlap the body */
+    memset(old_standbys, 0, sizeof(old_standbys));
+    if (!v3) {
+        memcpy(old_standbys, (char *)g_state + LAYOUT_V4_STANDBYS, sizeof(old_standbys));
+        for (int i = 0; i < MAX_STANDBYS; i++) {
+            if (standby_live(&old_standbys[i], get_realtime_ms())) {
+                fprintf(stderr, "Shared region is in use by an older build, "
+                        "stop it before upgrading\n");
+                return -1;
+            }
+        }
+    } else {
+        atomic_store_explicit(&g_state->takeover_request, 0, memory_order_relaxed);
+    }
+
+    /* Decode the old ring from the tail cell */
+    memcpy(old_body, g_state->body, sizeof(old_body));
+    uint32_t length = g_state->snake_length;
+    uint32_t tail = g_state->body_tail;
+    if (length > OLD_MAX_SNAKE_LEN || tail >= OLD_MAX_SNAKE_LEN) {
+        length = 0;  /* corrupt, let the next start begin a new game */
+    }
+    for (uint32_t i = 0; i < length; i++) {
+        if (i == 0) {
+            segs[0] = (Point){ g_state->tail_x, g_state->tail_y };
+            continue;
+        }
+        uint32_t index = (tail + i - 1) % OLD_MAX_SNAKE_LEN;
+        segs[i] = point_step(segs[i - 1], (old_body[index / 4] >> (index % 4 * 2)) & 3);
     }
 
+    memset(g_state->body, 0, sizeof(GameState) - offsetof(GameState, body));
+    body_load(segs, length);
+    memcpy(g_state->standbys, old_standbys, sizeof(old_standbys));
+    uint32_t features = g_state->feature_flags;
+    write_header();
+    g_state->feature_flags = features | FEATURES_KNOWN;
+    state_mark_dirty(g_state, sizeof(GameState));
+    state_flush();
     return 0;
 }
 
 /* Initialize a new game */
 static void init_game(void) {
+    if (!state_write_begin()) return;
     g_state->game_state = STATE_RUNNING;
     g_state->score = 0;
     g_state->snake_length = INITIAL_SNAKE_LEN;
@@ -269,35 +2628,102 @@ static void init_game(void) {
     int start_x = BOARD_WIDTH / 2;
     int start_y = BOARD_HEIGHT / 2;
 
+    /* Lay the body out left of the head, pointing right */
+    g_state->body_tail = 0;
+    g_state->tail_x = (int16_t)(start_x - (INITIAL_SNAKE_LEN - 1));
+    g_state->tail_y = (int16_t)start_y;
+    g_state->head_x = (int16_t)start_x;
+    g_state->head_y = (int16_t)start_y;
+    memset(g_state->occupancy, 0, sizeof(g_state->occupancy));
     for (uint32_t i = 0; i < g_state->snake_length; i++) {
-        g_state->snake[i].x = start_x - i;
-        g_state->snake[i].y = start_y;
+        if (i > 0) body_set_step(i - 1, DIR_RIGHT);
+        cell_set(start_x - i, start_y);
     }
 
+    /* Each game's seed comes from --seed or from the previous game, so a
+     * whole session replays from its first seed */
+    if (g_seed_set) {
+        rng_seed(g_seed);
+    } else {
+        uint64_t high = rng_next();
+        uint64_t low = rng_next();
+        rng_seed((high << 32) | low);
+    }
     spawn_food();
-    msync(g_state, sizeof(GameState), MS_SYNC);
+    state_mark_dirty(g_state, sizeof(GameState));
+    state_wake();
+    state_write_end();
 }
 
-/* Spawn food at random location */
+/* Spawn food on a free cell chosen uniformly: draw its rank among the
+ * free cells, then find it with one popcount per occupancy word. The
+ * cost does not depend on the snake length. */
 static void spawn_food(void) {
-    bool valid = false;
-    int x, y;
+    uint32_t rank = rng_bounded(BOARD_CELLS - g_state->snake_length);
+    uint32_t cell = 0;
 
-    while (!valid) {
-        x = rand() % BOARD_WIDTH;
-        y = rand() % BOARD_HEIGHT;
+    for (uint32_t w = 0; w < OCCUPANCY_WORDS; w++) {
+        uint32_t free_bits = ~g_state->occupancy[w];
+        if (w == OCCUPANCY_WORDS - 1 && BOARD_CELLS % 32 != 0) {
+            free_bits &= (1u << (BOARD_CELLS % 32)) - 1;
+        }
 
-        valid = true;
-        for (uint32_t i = 0; i < g_state->snake_length; i++) {
-            if (g_state->snake[i].x == x && g_state->snake[i].y == y) {
-                valid = false;
-                break;
+        uint32_t count = (uint32_t)__builtin_popcount(free_bits);
+        if (rank < count) {
+            while (rank-- > 0) {
+                free_bits &= free_bits - 1;  /* drop the lowest free cell */
             }
+            cell = w * 32 + (uint32_t)__builtin_ctz(free_bits);
+            break;
         }
+        rank -= count;
+    }
+
+    g_state->food_x = (int32_t)(cell % BOARD_WIDTH);
+    g_state->food_y = (int32_t)(cell / BOARD_WIDTH);
+    STATE_DIRTY(food_x);
+    STATE_DIRTY(food_y);
+}
+
+/* Restart the shared generator (PCG32) from a seed */
+static void rng_seed(uint64_t seed) {
+    g_state->rng_seed = seed;
+    g_state->rng_inc = (seed << 1) | 1;
+    g_state->rng_state = 0;
+    rng_next();
+    g_state->rng_state += seed;
+    rng_next();
+    STATE_DIRTY(rng_seed);
+    STATE_DIRTY(rng_inc);
+    STATE_DIRTY(rng_state);
+}
+
+/* Next 32-bit output of the shared generator. The state lives in the
+ * region, so whoever owns the game next continues the same sequence. A
+ * region from a build without it is seeded once from the clock. */
+static uint32_t rng_next(void) {
+    if (g_state->rng_inc == 0) {
+        rng_seed(((uint64_t)g_owner_id << 32) ^ get_time_ms());
     }
 
-    g_state->food_x = x;
-    g_state->food_y = y;
+    uint64_t old = g_state->rng_state;
+    g_state->rng_state = old * 6364136223846793005ULL + g_state->rng_inc;
+    STATE_DIRTY(rng_state);
+
+    uint32_t xorshifted = (uint32_t)(((old >> 18) ^ old) >> 27);
+    uint32_t rot = (uint32_t)(old >> 59);
+    return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+/* Uniform value in [0, bound), rejecting the biased low range */
+static uint32_t rng_bounded(uint32_t bound) {
+    uint32_t threshold = -bound % bound;
+    uint32_t r;
+
+    do {
+        r = rng_next();
+    } while (r < threshold);
+    return r % bound;
 }
 
 /* Move the snake */
@@ -306,15 +2732,10 @@ static void move_snake(void) {
         return;
     }
 
-    /* Calculate new head position */
-    Point new_head = g_state->snake[0];
+    if (!state_write_begin()) return;
 
-    switch (g_state->direction) {
-        case DIR_UP:    new_head.y--; break;
-        case DIR_DOWN:  new_head.y++; break;
-        case DIR_LEFT:  new_head.x--; break;
-        case DIR_RIGHT: new_head.x++; break;
-    }
+    /* Calculate new head position */
+    Point new_head = point_step(snake_head(), g_state->direction);
 
     /* Check wall collision */
     if (new_head.x < 0 || new_head.x >= BOARD_WIDTH ||
@@ -323,61 +2744,140 @@ static void move_snake(void) {
         if (g_state->score > g_state->high_score) {
             g_state->high_score = g_state->score;
         }
-        msync(g_state, sizeof(GameState), MS_SYNC);
+        STATE_DIRTY(game_state);
+        STATE_DIRTY(high_score);
+        state_wake();
+        state_write_end();
         return;
     }
 
     /* Check for food collision first */
     bool ate_food = (new_head.x == g_state->food_x && new_head.y == g_state->food_y);
 
-    /* Move body segments */
-    if (ate_food) {
-        /* Grow snake */
-        if (g_state->snake_length < MAX_SNAKE_LEN) {
-            /* Shift all segments back */
-            for (uint32_t i = g_state->snake_length; i > 0; i--) {
-                g_state->snake[i] = g_state->snake[i - 1];
-            }
-            g_state->snake_length++;
-        }
+    /* Advance the ring: the step to the new head is appended, and unless
+     * the snake grows the tail follows its own step. Only two bits of the
+     * body are written. */
+    body_set_step(g_state->body_tail + g_state->snake_length - 1, g_state->direction);
+    if (ate_food && g_state->snake_length < MAX_SNAKE_LEN) {
+        g_state->snake_length++;
+        STATE_DIRTY(snake_length);
     } else {
-        /* Normal move - shift segments */
-        for (uint32_t i = g_state->snake_length - 1; i > 0; i--) {
-            g_state->snake[i] = g_state->snake[i - 1];
-        }
+        Point tail = { g_state->tail_x, g_state->tail_y };
+        cell_clear(tail.x, tail.y);
+        tail = point_step(tail, body_step(g_state->body_tail));
+        g_state->tail_x = (int16_t)tail.x;
+        g_state->tail_y = (int16_t)tail.y;
+        g_state->body_tail = (g_state->body_tail + 1) % MAX_SNAKE_LEN;
+        STATE_DIRTY(tail_x);
+        STATE_DIRTY(tail_y);
+        STATE_DIRTY(body_tail);
     }
 
-    /* Set new head */
-    g_state->snake[0] = new_head;
+    /* Check for self collision before the head claims its cell, so the
+     * cell the tail just vacated is a legal move */
+    bool collided = check_collision(new_head);
+
+    g_state->head_x = (int16_t)new_head.x;
+    g_state->head_y = (int16_t)new_head.y;
+    STATE_DIRTY(head_x);
+    STATE_DIRTY(head_y);
+    cell_set(new_head.x, new_head.y);
 
-    /* Check for self collision */
-    if (check_collision()) {
+    if (collided) {
         g_state->game_state = STATE_GAMEOVER;
         if (g_state->score > g_state->high_score) {
             g_state->high_score = g_state->score;
         }
+        STATE_DIRTY(game_state);
+        STATE_DIRTY(high_score);
+        state_wake();
     }
 
-    /* Handle food */
+    /* Handle food; the game is won once no free cell is left for more */
     if (ate_food) {
         g_state->score += 10;
-        spawn_food();
+        STATE_DIRTY(score);
+        state_wake();
+        if (g_state->snake_length < BOARD_CELLS) {
+            spawn_food();
+        } else {
+            g_state->game_state = STATE_WON;
+            g_state->food_x = -1;
+            g_state->food_y = -1;
+            if (g_state->score > g_state->high_score) {
+                g_state->high_score = g_state->score;
+            }
+            STATE_DIRTY(game_state);
+            STATE_DIRTY(food_x);
+            STATE_DIRTY(food_y);
+            STATE_DIRTY(high_score);
+        }
     }
 
-    msync(g_state, sizeof(GameState), MS_SYNC);
+    /* Publish point for the move: the release in state_write_end() orders
+     * the body, occupancy and score stores before the even sequence count */
+    state_write_end();
 }
 
-/* Check if snake collided with itself */
-static bool check_collision(void) {
-    Point head = g_state->snake[0];
+/* Get the head cell */
+static Point snake_head(void) {
+    return (Point){ g_state->head_x, g_state->head_y };
+}
 
-    for (uint32_t i = 1; i < g_state->snake_length; i++) {
-        if (g_state->snake[i].x == head.x && g_state->snake[i].y == head.y) {
-            return true;
-        }
+/* Get the neighbour of a cell in a direction */
+static Point point_step(Point p, uint32_t dir) {
+    switch (dir) {
+        case DIR_UP:    p.y--; break;
+        case DIR_DOWN:  p.y++; break;
+        case DIR_LEFT:  p.x--; break;
+        case DIR_RIGHT: p.x++; break;
     }
+    return p;
+}
 
-    return false;
+/* Get the direction of a body step (index wraps around the ring) */
+static uint32_t body_step(uint32_t index) {
+    index %= MAX_SNAKE_LEN;
+    return (g_state->body[index / 4] >> (index % 4 * 2)) & 3;
+}
+
+/* Store the direction of a body step (index wraps around the ring) */
+static void body_set_step(uint32_t index, uint32_t dir) {
+    index %= MAX_SNAKE_LEN;
+    uint8_t shift = index % 4 * 2;
+    g_state->body[index / 4] = (uint8_t)((g_state->body[index / 4] & ~(3u << shift)) |
+                                         ((dir & 3) << shift));
+    STATE_DIRTY(body[index / 4]);
+}
+
+/* Check if a cell is covered by the snake */
+static bool cell_occupied(int x, int y) {
+    return occupancy_test(g_state->occupancy, x, y);
+}
+
+/* Check a cell in an occupancy bitmap */
+static bool occupancy_test(const uint32_t *occupancy, int x, int y) {
+    uint32_t cell = (uint32_t)(y * BOARD_WIDTH + x);
+    return (occupancy[cell / 32] >> (cell % 32)) & 1;
+}
+
+/* Mark a cell as covered by the snake */
+static void cell_set(int x, int y) {
+    uint32_t cell = (uint32_t)(y * BOARD_WIDTH + x);
+    g_state->occupancy[cell / 32] |= 1u << (cell % 32);
+    STATE_DIRTY(occupancy[cell / 32]);
+}
+
+/* Mark a cell as free */
+static void cell_clear(int x, int y) {
+    uint32_t cell = (uint32_t)(y * BOARD_WIDTH + x);
+    g_state->occupancy[cell / 32] &= ~(1u << (cell % 32));
+    STATE_DIRTY(occupancy[cell / 32]);
+}
+
+/* Check if the new head would run into the snake's body */
+static bool check_collision(Point head) {
+    return cell_occupied(head.x, head.y);
 }
 
 
@@ -390,329 +2890,396 @@ static int get_move_interval(void) {
     return interval;
 }
 
+/* Map a movement key to a direction, or -1 if it is not one */
+static int key_direction(int c) {
+    switch (c) {
+        case KEY_UP:    case 'w': case 'W': return DIR_UP;
+        case KEY_DOWN:  case 's': case 'S': return DIR_DOWN;
+        case KEY_LEFT:  case 'a': case 'A': return DIR_LEFT;
+        case KEY_RIGHT: case 'd': case 'D': return DIR_RIGHT;
+    }
+    return -1;
+}
+
 /* Handle keyboard input */
 static void handle_input(void) {
-    while (kbhit()) {
-        int c = getch();
+    int c;
 
+    while ((c = read_key()) != -1) {
         if (c == 'q' || c == 'Q') {
             g_running = 0;
             return;
         }
 
         if (c == 'p' || c == 'P') {
+            if (!state_write_begin()) return;
             if (g_state->game_state == STATE_RUNNING) {
                 g_state->game_state = STATE_PAUSED;
             } else if (g_state->game_state == STATE_PAUSED) {
                 g_state->game_state = STATE_RUNNING;
             }
-            msync(g_state, sizeof(GameState), MS_SYNC);
+            STATE_DIRTY(game_state);
+            state_write_end();
             continue;
         }
 
         if (c == 'r' || c == 'R') {
-            if (g_state->game_state == STATE_GAMEOVER) {
+            if (g_state->game_state == STATE_GAMEOVER || g_state->game_state == STATE_WON) {
                 init_game();
             }
             continue;
         }
 
         if (c == 't' || c == 'T') {
-            /* Request takeover - hand control to waiting process */
-            g_state->takeover_request = 1;
-            msync(g_state, sizeof(GameState), MS_SYNC);
-            g_is_active = false;  /* Switch to waiting mode */
-            g_initiated_takeover = true;  /* Don't respond to our own request */
-            return;
+            /* Request takeover - hand control to the first standby in
+             * handoff order, if there is one */
+            handoff_request();
+            continue;
         }
 
-        /* Arrow keys (ESC [ A/B/C/D) */
-        if (c == 27) {  /* ESC */
-            if (kbhit()) {
-                c = getch();
-                if (c == '[') {
-                    if (kbhit()) {
-                        c = getch();
-                        uint32_t new_dir = g_state->direction;
-
-                        switch (c) {
-                            case 'A': /* Up */
-                                if (g_state->direction != DIR_DOWN)
-                                    new_dir = DIR_UP;
-                                break;
-                            case 'B': /* Down */
-                                if (g_state->direction != DIR_UP)
-                                    new_dir = DIR_DOWN;
-                                break;
-                            case 'C': /* Right */
-                                if (g_state->direction != DIR_LEFT)
-                                    new_dir = DIR_RIGHT;
-                                break;
-                            case 'D': /* Left */
-                                if (g_state->direction != DIR_RIGHT)
-                                    new_dir = DIR_LEFT;
-                                break;
-                        }
-
-                        if (g_state->game_state == STATE_RUNNING &&
-                            new_dir != g_state->direction) {
-                            g_state->direction = new_dir;
-                            msync(g_state, sizeof(GameState), MS_SYNC);
-                        }
-                        continue;  /* Don't process arrow key char as WASD */
-                    }
-                }
-            }
-            continue;  /* ESC was pressed, skip WASD check */
+        /* Arrow keys or WASD, no reversing onto the body */
+        int dir = key_direction(c);
+        if (dir < 0 || g_state->game_state != STATE_RUNNING) {
+            continue;
         }
 
-        /* WASD keys as alternative */
-        if (g_state->game_state == STATE_RUNNING) {
-            uint32_t new_dir = g_state->direction;
-
-            switch (c) {
-                case 'w': case 'W':
-                    if (g_state->direction != DIR_DOWN)
-                        new_dir = DIR_UP;
-                    break;
-                case 's': case 'S':
-                    if (g_state->direction != DIR_UP)
-                        new_dir = DIR_DOWN;
-                    break;
-                case 'a': case 'A':
-                    if (g_state->direction != DIR_RIGHT)
-                        new_dir = DIR_LEFT;
-                    break;
-                case 'd': case 'D':
-                    if (g_state->direction != DIR_LEFT)
-                        new_dir = DIR_RIGHT;
-                    break;
-            }
+        uint32_t new_dir = g_state->direction;
+        switch (dir) {
+            case DIR_UP:
+                if (g_state->direction != DIR_DOWN) new_dir = DIR_UP;
+                break;
+            case DIR_DOWN:
+                if (g_state->direction != DIR_UP) new_dir = DIR_DOWN;
+                break;
+            case DIR_LEFT:
+                if (g_state->direction != DIR_RIGHT) new_dir = DIR_LEFT;
+                break;
+            case DIR_RIGHT:
+                if (g_state->direction != DIR_LEFT) new_dir = DIR_RIGHT;
+                break;
+        }
 
-            if (new_dir != g_state->direction) {
-                g_state->direction = new_dir;
-                msync(g_state, sizeof(GameState), MS_SYNC);
-            }
+        if (new_dir != g_state->direction) {
+            if (!state_write_begin()) return;
+            g_state->direction = new_dir;
+            STATE_DIRTY(direction);
+            state_write_end();
         }
     }
 }
 
-/* Render the game board */
-static void render(void) {
-    move_cursor(1, 1);
+/* Compose the title, score line and board of a game view */
+static void render_board(const GameSnapshot *view) {
+    frame_clear();
 
     /* Title and score */
-    printf("%s========== SNAKE GAME ==========%s\n", COLOR_CYAN, COLOR_RESET);
-    printf("Score: %s%u%s  |  High Score: %s%u%s  |  Length: %u\n",
-           COLOR_YELLOW, g_state->score, COLOR_RESET,
-           COLOR_GREEN, g_state->high_score, COLOR_RESET,
-           g_state->snake_length);
-
-    /* Top border */
-    printf("%s+", COLOR_WHITE);
-    for (int i = 0; i < BOARD_WIDTH; i++) printf("-");
-    printf("+%s\n", COLOR_RESET);
+    frame_text(0, 0, CLR_CYAN, "========== SNAKE GAME ==========");
+    int col = frame_text(1, 0, CLR_DEFAULT, "Score: ");
+    col = frame_text(1, col, CLR_YELLOW, "%u", view->score);
+    col = frame_text(1, col, CLR_DEFAULT, "  |  High Score: ");
+    col = frame_text(1, col, CLR_GREEN, "%u", view->high_score);
+    frame_text(1, col, CLR_DEFAULT, "  |  Length: %u", view->snake_length);
+
+    /* Top and bottom borders */
+    for (int x = 0; x < BOARD_WIDTH + 2; x++) {
+        char ch = (x == 0 || x == BOARD_WIDTH + 1) ? '+' : '-';
+        g_frame[2][x] = (Cell){ch, CLR_WHITE};
+        g_frame[BOARD_HEIGHT + 3][x] = (Cell){ch, CLR_WHITE};
+    }
 
     /* Game board */
     for (int y = 0; y < BOARD_HEIGHT; y++) {
-        printf("%s|%s", COLOR_WHITE, COLOR_RESET);
+        Cell *line = g_frame[y + 3];
+        line[0] = (Cell){'|', CLR_WHITE};
+        line[BOARD_WIDTH + 1] = (Cell){'|', CLR_WHITE};
 
         for (int x = 0; x < BOARD_WIDTH; x++) {
-            bool is_snake = false;
-            bool is_head = false;
-            bool is_food = false;
-
-            /* Check if position is snake head */
-            if (g_state->snake[0].x == x && g_state->snake[0].y == y) {
-                is_head = true;
-                is_snake = true;
-            }
-
-            /* Check if position is snake body */
-            if (!is_head) {
-                for (uint32_t i = 1; i < g_state->snake_length; i++) {
-                    if (g_state->snake[i].x == x && g_state->snake[i].y == y) {
-                        is_snake = true;
-                        break;
-                    }
-                }
-            }
-
-            /* Check if position is food */
-            if (g_state->food_x == x && g_state->food_y == y) {
-                is_food = true;
-            }
+            bool is_head = (view->head.x == x && view->head.y == y);
+            bool is_snake = occupancy_test(view->occupancy, x, y);
+            bool is_food = (view->food_x == x && view->food_y == y);
 
             if (is_head) {
-                printf("%s@%s", COLOR_BRIGHT_GREEN, COLOR_RESET);
+                line[x + 1] = (Cell){'@', CLR_BRIGHT_GREEN};
             } else if (is_snake) {
-                printf("%so%s", COLOR_GREEN, COLOR_RESET);
+                line[x + 1] = (Cell){'o', CLR_GREEN};
             } else if (is_food) {
-                printf("%s*%s", COLOR_RED, COLOR_RESET);
-            } else {
-                printf(" ");
+                line[x + 1] = (Cell){'*', CLR_RED};
             }
         }
-
-        printf("%s|%s\n", COLOR_WHITE, COLOR_RESET);
     }
+}
+
+/* Render the game board */
+static void render(void) {
+    static GameSnapshot view;
 
-    /* Bottom border */
-    printf("%s+", COLOR_WHITE);
-    for (int i = 0; i < BOARD_WIDTH; i++) printf("-");
-    printf("+%s\n", COLOR_RESET);
+    /* The active is the only writer, so a plain copy is consistent */
+    snapshot_copy(&view);
+    render_board(&view);
 
     /* Status and controls - single line to fit 80x24 */
+    int status_row = BOARD_HEIGHT + 4;
     if (g_state->game_state == STATE_PAUSED) {
-        printf("%s*** PAUSED - Press P to resume ***%s", COLOR_YELLOW, COLOR_RESET);
+        frame_text(status_row, 0, CLR_YELLOW, "*** PAUSED - Press P to resume ***");
     } else if (g_state->game_state == STATE_GAMEOVER) {
-        printf("%s*** GAME OVER - Press R to restart, Q to quit ***%s", COLOR_RED, COLOR_RESET);
+        frame_text(status_row, 0, CLR_RED, "*** GAME OVER - Press R to restart, Q to quit ***");
+    } else if (g_state->game_state == STATE_WON) {
+        frame_text(status_row, 0, CLR_GREEN, "*** YOU WIN - Press R to play again, Q to quit ***");
     } else {
-        printf("Arrows/WASD: Move | P: Pause | T: Transfer | Q: Quit");
+        frame_text(status_row, 0, CLR_DEFAULT, "Arrows/WASD: Move | P: Pause | T: Transfer | Q: Quit");
     }
 
-    fflush(stdout);
+    frame_present();
 }
 
-/* Render waiting screen with dialog box */
+/* Render the live game read-only while another process is active.
+ * Reading the board every frame also keeps this standby's copy of the
+ * shared state warm for a takeover. */
 static void render_waiting(void) {
-    /* Dialog box dimensions */
-    #define DIALOG_WIDTH 50
-    #define DIALOG_HEIGHT 9
-    int dialog_start_col = (80 - DIALOG_WIDTH) / 2;
-    int dialog_start_row = (24 - DIALOG_HEIGHT) / 2;
-
-    move_cursor(1, 1);
-
-    for (int row = 1; row <= 24; row++) {
-        move_cursor(row, 1);
-
-        /* Check if this row is part of the dialog */
-        int dialog_row = row - dialog_start_row;
-
-        if (dialog_row >= 0 && dialog_row < DIALOG_HEIGHT) {
-            /* Print spaces before dialog */
-            for (int i = 1; i < dialog_start_col; i++) printf(" ");
-
-            /* Print dialog content */
-            if (dialog_row == 0) {
-                /* Top border */
-                printf("%s+", COLOR_CYAN);
-                for (int i = 0; i < DIALOG_WIDTH - 2; i++) printf("-");
-                printf("+%s", COLOR_RESET);
-            } else if (dialog_row == DIALOG_HEIGHT - 1) {
-                /* Bottom border */
-                printf("%s+", COLOR_CYAN);
-                for (int i = 0; i < DIALOG_WIDTH - 2; i++) printf("-");
-                printf("+%s", COLOR_RESET);
-            } else {
-                /* Content rows */
-                printf("%s|%s", COLOR_CYAN, COLOR_RESET);
-
-                char line[DIALOG_WIDTH - 1];
-                memset(line, ' ', DIALOG_WIDTH - 2);
-                line[DIALOG_WIDTH - 2] = '\0';
-
-                if (dialog_row == 2) {
-                    const char *title = "WAITING FOR CONTROL";
-                    int title_start = (DIALOG_WIDTH - 2 - (int)strlen(title)) / 2;
-                    memcpy(line + title_start, title, strlen(title));
-                    printf("%s%s%s", COLOR_YELLOW, line, COLOR_RESET);
-                } else if (dialog_row == 4) {
-                    const char *msg = "Another process is running the game.";
-                    int msg_start = (DIALOG_WIDTH - 2 - (int)strlen(msg)) / 2;
-                    memcpy(line + msg_start, msg, strlen(msg));
-                    printf("%s", line);
-                } else if (dialog_row == 5) {
-                    char score_line[64];
-                    snprintf(score_line, sizeof(score_line),
-                             "Score: %u  |  High Score: %u",
-                             g_state->score, g_state->high_score);
-                    int score_start = (DIALOG_WIDTH - 2 - (int)strlen(score_line)) / 2;
-                    memcpy(line + score_start, score_line, strlen(score_line));
-                    printf("%s", line);
-                } else if (dialog_row == 7) {
-                    const char *quit_msg = "Press Q to quit";
-                    int quit_start = (DIALOG_WIDTH - 2 - (int)strlen(quit_msg)) / 2;
-                    memcpy(line + quit_start, quit_msg, strlen(quit_msg));
-                    printf("%s%s%s", COLOR_WHITE, line, COLOR_RESET);
-                } else {
-                    printf("%s", line);
-                }
+    static GameSnapshot view;
 
-                printf("%s|%s", COLOR_CYAN, COLOR_RESET);
-            }
+    /* Keep the previous frame if the active is stuck mid-update */
+    if (!state_snapshot(&view)) {
+        return;
+    }
 
-            /* Print spaces after dialog */
-            for (int i = dialog_start_col + DIALOG_WIDTH; i <= 80; i++) printf(" ");
-        } else {
-            /* Empty row outside dialog */
-            for (int i = 0; i < 80; i++) printf(" ");
-        }
+    render_board(&view);
+
+    int status_row = BOARD_HEIGHT + 4;
+    int col = frame_text(status_row, 0, CLR_YELLOW, "WATCHING");
+    if (view.game_state == STATE_PAUSED) {
+        col = frame_text(status_row, col, CLR_YELLOW, " (paused)");
+    } else if (view.game_state == STATE_GAMEOVER) {
+        col = frame_text(status_row, col, CLR_RED, " (game over)");
+    } else if (view.game_state == STATE_WON) {
+        col = frame_text(status_row, col, CLR_GREEN, " (won)");
+    }
+    if (g_standby >= 0) {
+        col = frame_text(status_row, col, CLR_CYAN, " | Standby %u of %u, priority %d",
+                         g_standby_rank + 1, g_standby_count, g_priority);
+    }
+    if (view.fence_events != 0) {
+        col = frame_text(status_row, col, CLR_RED, " | Fenced %u", view.fence_events);
     }
+    frame_text(status_row, col, CLR_DEFAULT, " | Q: Quit");
 
-    fflush(stdout);
+    frame_present();
 }
 
 /* Print usage */
 static void print_usage(const char *prog) {
-    fprintf(stderr, "Usage: %s [file] [offset]\n", prog);
-    fprintf(stderr, "  file   - mmap file path (default: %s)\n", MEM_FILE);
-    fprintf(stderr, "  offset - hex offset in file, e.g. 1000 or 0x1000 (default: 0)\n");
+    fprintf(stderr, "Usage: %s [options] [file] [offset]\n", prog);
+    fprintf(stderr, "  file   - mmap file path or object name (default: per backend)\n");
+    fprintf(stderr, "  offset - hex offset in file, e.g. 1000 or 0x1000 (default: per backend)\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -b, --backend NAME  memory backend (default: devmem for a character\n"
+                    "                      device, file otherwise):\n");
+    for (size_t i = 0; i < sizeof(g_mem_backends) / sizeof(g_mem_backends[0]); i++) {
+        fprintf(stderr, "      %-10s %s, offset 0x%llx\n", g_mem_backends[i].name,
+                g_mem_backends[i].default_path,
+                (unsigned long long)g_mem_backends[i].default_offset);
+    }
+    fprintf(stderr, "  -s, --session ID    play session ID of a multi-session region, creating it\n"
+                    "                      if needed (the region starts with a session directory)\n");
+    fprintf(stderr, "  -n, --sessions N    session slots when creating a directory (default: %d)\n",
+            DEFAULT_SESSIONS);
+    fprintf(stderr, "  -l, --list-sessions list the sessions of a multi-session region and exit\n");
+    fprintf(stderr, "  -F, --free-session ID  release the slot of a session that is not running\n");
+    fprintf(stderr, "      --heartbeat-ms MS  heartbeat period while active (default: %d); the\n"
+                    "                      lease lasts %d heartbeats\n",
+            HEARTBEAT_INTERVAL_MS, LEASE_TICKS);
+    fprintf(stderr, "      --check-ms MS  heartbeat check period while waiting\n"
+                    "                      (default: half the active's heartbeat period)\n");
+    fprintf(stderr, "      --probe-ms MS  startup wait for an active process whose last\n"
+                    "                      heartbeat time is unknown (default: its lease plus\n"
+                    "                      one heartbeat); when set, any held lease is probed\n");
+    fprintf(stderr, "      --takeover-delay-ms MS  pause showing the takeover message (default: %d)\n",
+            TAKEOVER_DELAY_MS);
+    fprintf(stderr, "      --priority N   standby priority, -%d to %d (default: 0); 't' hands over\n"
+                    "                      to, and failover prefers, the highest priority\n",
+            MAX_PRIORITY, MAX_PRIORITY);
+    fprintf(stderr, "      --spectator-fps N  frame rate of the live board while waiting\n"
+                    "                      (default: %d)\n", SPECTATOR_FPS);
+    fprintf(stderr, "      --seed N       start every new game from food seed N (default: each\n"
+                    "                      game is seeded from the previous one)\n");
+    fprintf(stderr, "  -P, --prefault      populate and lock the mapping at startup\n");
+    fprintf(stderr, "  -H, --hugepages     use huge pages (memfd, hugetlbfs: hugetlb pool, shm: THP\n"
+                    "                      advice; not available for devmem and file)\n");
+    fprintf(stderr, "  -f, --flush NAME    cache flush backend: auto, ");
+    for (size_t i = 0; i < sizeof(g_flush_backends) / sizeof(g_flush_backends[0]); i++) {
+        fprintf(stderr, "%s%s", i ? ", " : "", g_flush_backends[i].name);
+    }
+    fprintf(stderr, " (default: auto)\n");
+    fprintf(stderr, "  -h, --help          show this help\n");
 }
 
 /* Main function */
 int main(int argc, char *argv[]) {
     /* Parse arguments */
-    if (argc > 1) {
-        if (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
-            print_usage(argv[0]);
-            return 0;
+    static const struct option long_options[] = {
+        { "backend", required_argument, NULL, 'b' },
+        { "flush", required_argument, NULL, 'f' },
+        { "session", required_argument, NULL, 's' },
+        { "sessions", required_argument, NULL, 'n' },
+        { "list-sessions", no_argument, NULL, 'l' },
+        { "free-session", required_argument, NULL, 'F' },
+        { "prefault", no_argument, NULL, 'P' },
+        { "hugepages", no_argument, NULL, 'H' },
+        { "heartbeat-ms", required_argument, NULL, OPT_HEARTBEAT_MS },
+        { "check-ms", required_argument, NULL, OPT_CHECK_MS },
+        { "probe-ms", required_argument, NULL, OPT_PROBE_MS },
+        { "takeover-delay-ms", required_argument, NULL, OPT_TAKEOVER_DELAY_MS },
+        { "priority", required_argument, NULL, OPT_PRIORITY },
+        { "spectator-fps", required_argument, NULL, OPT_SPECTATOR_FPS },
+        { "seed", required_argument, NULL, OPT_SEED },
+        { "help",  no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "b:f:s:n:lF:PHh", long_options, NULL)) != -1) {
+        char *endptr;
+
+        switch (opt) {
+            case 's':
+            case 'F':
+                g_session_id = strtoll(optarg, &endptr, 10);
+                if (*endptr != '\0' || g_session_id < 0 || g_session_id > UINT32_MAX) {
+                    fprintf(stderr, "Invalid session id: %s\n", optarg);
+                    return 1;
+                }
+                if (opt == 'F') g_session_cmd = SESSION_CMD_FREE;
+                break;
+            case 'n': {
+                unsigned long count = strtoul(optarg, &endptr, 10);
+                if (*endptr != '\0' || count == 0 || count > MAX_SESSIONS) {
+                    fprintf(stderr, "Invalid session count: %s (1-%d)\n", optarg, MAX_SESSIONS);
+                    return 1;
+                }
+                g_max_sessions = (uint32_t)count;
+                break;
+            }
+            case 'l':
+                g_session_cmd = SESSION_CMD_LIST;
+                break;
+            case OPT_PRIORITY: {
+                long priority = strtol(optarg, &endptr, 10);
+                if (*endptr != '\0' || priority < -MAX_PRIORITY || priority > MAX_PRIORITY) {
+                    fprintf(stderr, "Invalid priority: %s (%d to %d)\n", optarg,
+                            -MAX_PRIORITY, MAX_PRIORITY);
+                    return 1;
+                }
+                g_priority = (int32_t)priority;
+                break;
+            }
+            case OPT_SPECTATOR_FPS: {
+                unsigned long fps = strtoul(optarg, &endptr, 10);
+                if (*endptr != '\0' || fps == 0 || fps > MAX_SPECTATOR_FPS) {
+                    fprintf(stderr, "Invalid frame rate: %s (1-%d)\n", optarg,
+                            MAX_SPECTATOR_FPS);
+                    return 1;
+                }
+                g_spectator_ms = (uint32_t)(1000 / fps);
+                break;
+            }
+            case OPT_SEED:
+                g_seed = strtoull(optarg, &endptr, 0);
+                if (*endptr != '\0' || optarg[0] == '-') {
+                    fprintf(stderr, "Invalid seed: %s\n", optarg);
+                    return 1;
+                }
+                g_seed_set = true;
+                break;
+            case OPT_HEARTBEAT_MS:
+            case OPT_CHECK_MS:
+            case OPT_PROBE_MS:
+            case OPT_TAKEOVER_DELAY_MS: {
+                unsigned long ms = strtoul(optarg, &endptr, 10);
+                bool delay = (opt == OPT_TAKEOVER_DELAY_MS);
+                if (*endptr != '\0' || ms > 60000 || (!delay && ms < MIN_TIMING_MS)) {
+                    fprintf(stderr, "Invalid time: %s ms (%d-60000)\n", optarg,
+                            delay ? 0 : MIN_TIMING_MS);
+                    return 1;
+                }
+                if (opt == OPT_HEARTBEAT_MS) g_heartbeat_ms = (uint32_t)ms;
+                if (opt == OPT_CHECK_MS) g_check_ms = (uint32_t)ms;
+                if (opt == OPT_PROBE_MS) g_probe_ms = (uint32_t)ms;
+                if (delay) g_takeover_delay_ms = (uint32_t)ms;
+                break;
+            }
+            case 'P':
+                g_prefault = true;
+                break;
+            case 'H':
+                g_hugepages = true;
+                break;
+            case 'b':
+                g_mem_backend_name = optarg;
+                break;
+            case 'f':
+                g_flush_name = optarg;
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                return 1;
         }
-        g_mem_file = argv[1];
     }
-    if (argc > 2) {
+
+    if (optind < argc) {
+        g_mem_file = argv[optind++];
+    }
+    if (optind < argc) {
         char *endptr;
-        long long offset = strtoll(argv[2], &endptr, 16);
+        long long offset = strtoll(argv[optind], &endptr, 16);
         if (*endptr != '\0' || offset < 0) {
-            fprintf(stderr, "Invalid hex offset: %s\n", argv[2]);
+            fprintf(stderr, "Invalid hex offset: %s\n", argv[optind]);
             print_usage(argv[0]);
             return 1;
         }
         g_mem_offset = (off_t)offset;
     }
 
-    /* Initialize random seed */
+    if (setup_backend() != 0 || setup_flush() != 0) {
+        return 1;
+    }
+
+    /* Seed the process-local generator used for the owner id */
     srand((unsigned int)time(NULL) ^ (unsigned int)getpid());
+    while (g_owner_id == 0) {
+        g_owner_id = ((uint32_t)rand() << 1) ^ (uint32_t)rand();
+    }
+    g_node_id = hash_node_id();
 
     /* Setup cleanup */
     atexit(cleanup);
     setup_signals();
 
+    if (g_session_cmd != SESSION_CMD_NONE) {
+        return run_session_command();
+    }
+
     /* Setup mmap */
     if (setup_mmap() != 0) {
         fprintf(stderr, "Failed to setup shared memory\n");
         return 1;
     }
 
+    if (setup_timers() != 0) {
+        return 1;
+    }
+
     /* Enable terminal raw mode */
     enable_raw_mode();
     hide_cursor();
     clear_screen();
 
     /* Check if another process is active */
-    uint64_t initial_heartbeat = g_state->heartbeat;
-
-    printf("Checking for active process...\n");
-    fflush(stdout);
-
-    /* Wait 1.5 seconds to check heartbeat */
-    usleep(1500000);
-
-    uint64_t current_heartbeat = g_state->heartbeat;
-
-    if (current_heartbeat != initial_heartbeat) {
-        /* Another process is active, enter waiting state */
+    if (!claim_at_startup()) {
+        /* Another process is active or claimed the lease first, enter
+         * waiting state */
         g_is_active = false;
     } else {
         /* No active process, we become active */
@@ -724,115 +3291,279 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    struct pollfd fds[POLL_COUNT] = {
+        [POLL_STDIN]     = { .fd = STDIN_FILENO,    .events = POLLIN },
+        [POLL_MOVE]      = { .fd = g_move_tfd,      .events = POLLIN },
+        [POLL_HEARTBEAT] = { .fd = g_heartbeat_tfd, .events = POLLIN },
+        [POLL_RENDER]    = { .fd = g_render_tfd,    .events = POLLIN },
+        [POLL_WAKE]      = { .fd = -1,              .events = POLLIN },
+    };
+
     /* Main state loop - can switch between active and waiting */
     while (g_running) {
         if (g_is_active) {
-            /* Active game loop */
+            /* Active game loop; our wake thread only runs during a handoff */
             clear_screen();
+            fds[POLL_WAKE].fd = -1;
+            wake_stop();
+
+            /* Pick up everything the previous owner wrote */
+            state_invalidate(g_state, sizeof(GameState));
+
+            /* A previous owner may have died inside a write section */
+            state_write_recover();
+
+            /* Clear any pending handoff since we're now active */
+            atomic_store_explicit(&g_state->takeover_request, 0, memory_order_release);
+            STATE_DIRTY(takeover_request);
+            state_flush();
+            g_handoff_target = 0;
+
+            timer_arm(g_heartbeat_tfd, g_heartbeat_ms, g_heartbeat_ms);
+            timer_arm(g_render_tfd, 0, 0);
+            uint32_t armed_interval = 0;   /* move timer period, 0 = disarmed */
+            uint64_t last_move = get_time_ms() - g_handoff_phase_ms;
+            uint32_t phase_ms = g_handoff_phase_ms;  /* keep the tick phase of a handoff */
+            g_handoff_phase_ms = 0;
+            uint64_t last_frame_time = 0;
+            bool dirty = true;             /* state changed since last frame */
+            bool frame_pending = false;    /* render timer armed */
+
+            while (g_running && g_is_active) {
+                /* Keep the move timer in step with the game state and speed */
+                uint32_t interval = (g_state->game_state == STATE_RUNNING) ?
+                                    (uint32_t)get_move_interval() : 0;
+                if (interval != armed_interval) {
+                    uint32_t first = interval;
+                    if (phase_ms != 0 && interval != 0) {
+                        first = phase_ms < interval ? interval - phase_ms : 1;
+                        phase_ms = 0;
+                    }
+                    timer_arm(g_move_tfd, first, interval);
+                    armed_interval = interval;
+                }
 
-            /* Clear any pending takeover request since we're now active */
-            g_state->takeover_request = 0;
-            msync(g_state, sizeof(GameState), MS_SYNC);
+                /* Render right away, or at the next frame deadline if the
+                 * last frame went out less than a frame interval ago */
+                if (dirty && !frame_pending) {
+                    uint64_t since = get_time_ms() - last_frame_time;
+                    if (since >= FRAME_INTERVAL_MS) {
+                        render();
+                        last_frame_time = get_time_ms();
+                        dirty = false;
+                    } else {
+                        timer_arm(g_render_tfd, FRAME_INTERVAL_MS - since, 0);
+                        frame_pending = true;
+                    }
+                }
 
-            uint64_t last_move_time = get_time_ms();
-            uint64_t last_heartbeat_time = get_time_ms();
+                /* Sleep until input arrives or a timer fires */
+                if (poll(fds, POLL_COUNT, -1) < 0) {
+                    if (errno == EINTR) continue;
+                    perror("poll");
+                    break;
+                }
 
-            while (g_running && g_is_active) {
-                uint64_t now = get_time_ms();
+                /* Terminal went away */
+                if (fds[POLL_STDIN].revents & (POLLHUP | POLLERR)) {
+                    g_running = 0;
+                    break;
+                }
 
-                /* Handle input (may set g_is_active = false on 't' press) */
-                handle_input();
+                /* Step down at once if another process acts as the owner;
+                 * the previous iteration flushed everything we wrote */
+                if (!owner_check()) {
+                    state_flush();
+                    break;
+                }
 
-                if (!g_running || !g_is_active) break;
+                /* Commit or abort a pending handoff before this tick's
+                 * writes; a commit ends our turn */
+                if (g_handoff_target != 0) {
+                    handoff_step(last_move);
+                    if (!g_is_active) {
+                        state_flush();
+                        break;
+                    }
+                }
 
-                /* Update heartbeat every 500ms */
-                if (now - last_heartbeat_time >= 500) {
-                    g_state->heartbeat++;
-                    msync(g_state, sizeof(GameState), MS_SYNC);
-                    last_heartbeat_time = now;
+                /* Handle input ('t' starts a handoff) */
+                if (fds[POLL_STDIN].revents & POLLIN) {
+                    handle_input();
+                    dirty = true;
                 }
 
-                /* Move snake at interval */
-                int move_interval = get_move_interval();
-                if (g_state->game_state == STATE_RUNNING &&
-                    now - last_move_time >= (uint64_t)move_interval) {
-                    move_snake();
-                    last_move_time = now;
+                /* While a handoff is pending, a target on this host wakes
+                 * us with its accept instead of leaving it to the next tick */
+                if (fds[POLL_WAKE].revents & POLLIN) {
+                    wake_drain();
+                }
+                if (g_handoff_target != 0 && wake_start()) {
+                    fds[POLL_WAKE].fd = g_wake_efd;
+                } else {
+                    fds[POLL_WAKE].fd = -1;
+                    wake_stop();
                 }
 
-                /* Render */
-                render();
+                if (g_running && g_is_active) {
+                    if (fds[POLL_HEARTBEAT].revents & POLLIN &&
+                        timer_expired(g_heartbeat_tfd)) {
+                        heartbeat_publish();
+                    }
+
+                    if (fds[POLL_MOVE].revents & POLLIN && timer_expired(g_move_tfd)) {
+                        last_move = get_time_ms();
+                        move_snake();
+                        dirty = true;
+                    }
+
+                    if (fds[POLL_RENDER].revents & POLLIN && timer_expired(g_render_tfd)) {
+                        frame_pending = false;
+                    }
+                }
 
-                /* Small delay to prevent CPU hogging */
-                usleep(16000);  /* ~60 FPS */
+                /* Single flush point for everything written this tick */
+                state_flush();
             }
+
+            timer_arm(g_move_tfd, 0, 0);
         } else {
             /* Waiting loop */
             clear_screen();
 
-            uint64_t last_heartbeat = g_state->heartbeat;
-            uint64_t last_check_time = get_time_ms();
+            FailureDetector detector;
+            detector_reset(&detector);
+            standby_check();
+
+            /* Sample the heartbeat twice per owner period unless configured */
+            uint32_t check_ms = g_check_ms ? g_check_ms : owner_heartbeat_ms() / 2;
+            if (check_ms < MIN_TIMING_MS) check_ms = MIN_TIMING_MS;
+            timer_arm(g_heartbeat_tfd, check_ms, check_ms);
+
+            /* The live board refreshes at the spectator frame rate; waiters
+             * on the active's host also react at once to futex wakeups */
+            bool woken = wake_usable();
+            wake_drain();
+            fds[POLL_WAKE].fd = woken ? g_wake_efd : -1;
+            timer_arm(g_render_tfd, g_spectator_ms, g_spectator_ms);
+            render_waiting();
+            uint64_t released_at = 0;   /* when we saw the lease freed, 0 = held */
 
             while (g_running && !g_is_active) {
+                if (poll(fds, POLL_COUNT, -1) < 0) {
+                    if (errno == EINTR) continue;
+                    perror("poll");
+                    break;
+                }
+
+                /* Terminal went away */
+                if (fds[POLL_STDIN].revents & (POLLHUP | POLLERR)) {
+                    g_running = 0;
+                    break;
+                }
+
                 /* Handle quit input */
-                while (kbhit()) {
-                    int c = getch();
-                    if (c == 'q' || c == 'Q') {
-                        g_running = 0;
-                        break;
-                    }
-                    /* Handle ESC sequences */
-                    if (c == 27) {
-                        while (kbhit()) getch();
+                if (fds[POLL_STDIN].revents & POLLIN) {
+                    int c;
+                    while ((c = read_key()) != -1) {
+                        if (c == 'q' || c == 'Q') {
+                            g_running = 0;
+                            break;
+                        }
                     }
                 }
 
                 if (!g_running) break;
 
-                /* Check for takeover request (active pressed 't') */
-                if (g_state->takeover_request) {
-                    if (!g_initiated_takeover) {
-                        /* Other process wants to hand over control to us */
+                bool refresh = fds[POLL_RENDER].revents & POLLIN && timer_expired(g_render_tfd);
+                if (fds[POLL_WAKE].revents & POLLIN) {
+                    wake_drain();
+                    refresh = true;
+                }
+
+                /* Once we have accepted, the commit is polled on its own
+                 * short timer rather than at the spectator frame rate */
+                bool poll_handoff = fds[POLL_MOVE].revents & POLLIN &&
+                                    timer_expired(g_move_tfd);
+
+                if (refresh || poll_handoff) {
+                    /* Answer a handoff addressed to us (active pressed 't') */
+                    bool polling = g_handoff_accepted;
+                    if (handoff_answer()) {
                         g_is_active = true;
-                        g_state->takeover_request = 0;
-                        msync(g_state, sizeof(GameState), MS_SYNC);
                         clear_screen();
                         break;
                     }
-                    /* else: We initiated this - wait for other process to respond */
-                } else if (g_initiated_takeover) {
-                    /* Takeover request was cleared - other process took over */
-                    g_initiated_takeover = false;
-                }
+                    if (g_handoff_accepted != polling) {
+                        timer_arm(g_move_tfd, g_handoff_accepted ? MIN_TIMING_MS : 0,
+                                  g_handoff_accepted ? MIN_TIMING_MS : 0);
+                    }
 
-                /* Check heartbeat every second */
-                uint64_t now = get_time_ms();
-                if (now - last_check_time >= 1000) {
-                    uint64_t current_hb = g_state->heartbeat;
+                    if (refresh) render_waiting();
+                }
 
-                    if (current_hb == last_heartbeat) {
-                        /* Other process died, take over */
-                        g_is_active = true;
-                        g_initiated_takeover = false;
-                        clear_screen();
-                        printf("Taking over control...\n");
-                        fflush(stdout);
-                        usleep(500000);
+                bool take = false;
+                bool tick = fds[POLL_HEARTBEAT].revents & POLLIN &&
+                            timer_expired(g_heartbeat_tfd);
+
+                /* The owner shut down cleanly and freed the lease (its
+                 * release wakes us): the first standby in handoff order
+                 * claims it at once, the others one heartbeat period per
+                 * standby ranked ahead of them later */
+                if (refresh || tick) {
+                    uint64_t lease = lease_read();
+                    STATE_INVALIDATE(feature_flags);
+                    if (LEASE_OWNER(lease) != 0 ||
+                        !(g_state->feature_flags & FEATURE_LEASE)) {
+                        released_at = 0;
+                    } else if (released_at == 0) {
+                        released_at = get_time_ms();
+                    }
+                    take = released_at != 0 &&
+                           get_time_ms() - released_at >=
+                               (uint64_t)g_standby_rank * owner_heartbeat_ms() &&
+                           lease_claim(lease);
+                }
 
-                        /* Resume from saved state */
-                        if (g_state->snake_length == 0) {
-                            init_game();
-                        }
-                        break;
+                /* Check the heartbeat. Standbys wait one more heartbeat
+                 * period per standby ranked ahead of them, so failover goes
+                 * to the first live standby in handoff order. */
+                if (!take && tick) {
+                    standby_check();
+
+                    /* The lease may have moved to or from this host; a
+                     * remote owner's wakes never reach our thread */
+                    if (wake_usable() != woken) {
+                        woken = !woken;
+                        if (!woken) wake_stop();
+                        fds[POLL_WAKE].fd = woken ? g_wake_efd : -1;
                     }
 
-                    last_heartbeat = current_hb;
-                    last_check_time = now;
+                    uint64_t timeout = detector_timeout_ms(&detector) +
+                                       (uint64_t)g_standby_rank * owner_heartbeat_ms();
+                    /* Other process died and its lease expired */
+                    take = !detector_observe(&detector) &&
+                           get_time_ms() - detector.last_change >= timeout &&
+                           lease_claim(detector.lease);
                 }
 
-                render_waiting();
-                usleep(100000);  /* 100ms */
+                if (take) {
+                    g_is_active = true;
+                    clear_screen();
+                    out_str("Taking over control...\n");
+                    out_flush();
+                    takeover_pause();
+
+                    /* Resume from saved state */
+                    if (g_state->snake_length == 0) {
+                        init_game();
+                    }
+                    break;
+                }
             }
+
+            timer_arm(g_move_tfd, 0, 0);
+            g_handoff_accepted = false;
         }
     }
 